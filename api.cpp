@@ -100,7 +100,8 @@ extern int opt_api_listen; /* port */
 extern uint32_t accepted_count;
 extern uint32_t rejected_count;
 extern int num_cpus;
-extern struct stratum_ctx stratum;
+extern struct stratum_ctx *stratum_lock(void);
+extern void stratum_unlock(void);
 extern char* rpc_user;
 
 // sysinfos.cpp
@@ -122,22 +123,21 @@ static void gpustatus(int thr_id)
 		char buf[512]; *buf = '\0';
 		char* card;
 
+		/* virtual GPUs have no driver to ask, like the CPU */
+		if (!opt_cpumining && !opt_virtual_gpus) {
 #ifdef USE_WRAPNVML
-		cgpu->has_monitoring = true;
-		cgpu->gpu_bus = gpu_busid(cgpu);
-		cgpu->gpu_temp = gpu_temp(cgpu);
-		cgpu->gpu_fan = (uint16_t) gpu_fanpercent(cgpu);
-		cgpu->gpu_fan_rpm = (uint16_t) gpu_fanrpm(cgpu);
+			cgpu->has_monitoring = true;
+			cgpu->gpu_bus = gpu_busid(cgpu);
+			cgpu->gpu_temp = gpu_temp(cgpu);
+			cgpu->gpu_fan = (uint16_t) gpu_fanpercent(cgpu);
+			cgpu->gpu_fan_rpm = (uint16_t) gpu_fanrpm(cgpu);
 #endif
-		cuda_gpu_clocks(cgpu);
-
-		// todo: per gpu
-		cgpu->accepted = accepted_count;
-		cgpu->rejected = rejected_count;
+			cuda_gpu_clocks(cgpu);
+		}
 
 		cgpu->khashes = stats_get_speed(cgpu->gpu_id, 0.0) / 1000.0;
 
-		card = device_name[gpuid];
+		card = opt_cpumining ? (char *) "CPU" : device_name[gpuid];
 
 		snprintf(buf, sizeof(buf), "GPU=%d;BUS=%hd;CARD=%s;"
 			"TEMP=%.1f;FAN=%hu;RPM=%hu;FREQ=%d;KHS=%.2f;HWF=%d;I=%.1f;THR=%u|",
@@ -194,26 +194,32 @@ static char *getpoolnfo(char *params)
 	char *p = buffer;
 	char jobid[128] = { 0 };
 	char nonce[128] = { 0 };
+	struct stratum_ctx *sctx = stratum_lock();	/* the pool mined on */
 	*p = '\0';
 
-	if (!stratum.url) {
+	if (!sctx->url) {
+		stratum_unlock();
 		sprintf(p, "|");
 		return p;
 	}
 
-	if (stratum.job.job_id)
-		strncpy(jobid, stratum.job.job_id, sizeof(stratum.job.job_id));
+	/* the pool thread changes the job under work_lock */
+	pthread_mutex_lock(&sctx->work_lock);
+	if (sctx->job.job_id)
+		strncpy(jobid, sctx->job.job_id, sizeof(jobid) - 1);
 
-	if (stratum.job.xnonce2) {
+	if (sctx->job.xnonce2) {
 		/* used temporary to be sure all is ok */
-		cbin2hex(nonce, (const char*) stratum.job.xnonce2, stratum.xnonce2_size);
+		cbin2hex(nonce, (const char*) sctx->job.xnonce2, sctx->xnonce2_size);
 	}
 
-	snprintf(p, MYBUFSIZ, "URL=%s;USER=%s;H=%u;JOB=%s;DIFF=%.6f;N2SZ=%d;N2=0x%s;PING=%u;DISCO=%u;UPTIME=%u|",
-		stratum.url, rpc_user ? rpc_user : "",
-		stratum.job.height, jobid, stratum.job.diff,
-		(int) stratum.xnonce2_size, nonce, stratum.answer_msec,
-		stratum.disconnects, (uint32_t) (time(NULL) - stratum.tm_connected));
+	snprintf(p, MYBUFSIZ, "POOL=%d;URL=%s;USER=%s;H=%u;JOB=%s;DIFF=%.6f;N2SZ=%d;N2=0x%s;PING=%u;DISCO=%u;UPTIME=%u|",
+		sctx->pooln, sctx->url, sctx->user ? sctx->user : (rpc_user ? rpc_user : ""),
+		sctx->job.height, jobid, sctx->job.diff,
+		(int) sctx->xnonce2_size, nonce, sctx->answer_msec,
+		sctx->disconnects, (uint32_t) (time(NULL) - sctx->tm_connected));
+	pthread_mutex_unlock(&sctx->work_lock);
+	stratum_unlock();
 
 	return p;
 }
@@ -237,17 +243,18 @@ static void gpuhwinfos(int gpu_id)
 	if (cgpu == NULL)
 		return;
 
+	if (!opt_virtual_gpus) {
 #ifdef USE_WRAPNVML
-	cgpu->has_monitoring = true;
-	cgpu->gpu_bus = gpu_busid(cgpu);
-	cgpu->gpu_temp = gpu_temp(cgpu);
-	cgpu->gpu_fan = (uint16_t) gpu_fanpercent(cgpu);
-	cgpu->gpu_fan_rpm = (uint16_t) gpu_fanrpm(cgpu);
-	cgpu->gpu_pstate = gpu_pstate(cgpu);
-	gpu_info(cgpu);
+		cgpu->has_monitoring = true;
+		cgpu->gpu_bus = gpu_busid(cgpu);
+		cgpu->gpu_temp = gpu_temp(cgpu);
+		cgpu->gpu_fan = (uint16_t) gpu_fanpercent(cgpu);
+		cgpu->gpu_fan_rpm = (uint16_t) gpu_fanrpm(cgpu);
+		cgpu->gpu_pstate = gpu_pstate(cgpu);
+		gpu_info(cgpu);
 #endif
-
-	cuda_gpu_clocks(cgpu);
+		cuda_gpu_clocks(cgpu);
+	}
 
 	memset(pstate, 0, sizeof(pstate));
 	if (cgpu->gpu_pstate != -1)
@@ -307,7 +314,7 @@ static void syshwinfos()
 static char *gethwinfos(char *params)
 {
 	*buffer = '\0';
-	for (int i = 0; i < cuda_num_devices(); i++)
+	for (int i = 0; !opt_cpumining && i < cuda_num_devices(); i++)
 		gpuhwinfos(i);
 	syshwinfos();
 	return buffer;
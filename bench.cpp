@@ -0,0 +1,406 @@
+/**
+ * Micro benchmarks of the hashing primitives, see --bench-hashes
+ *
+ * Every primitive is timed in batches on one thread for throughput
+ * and cycles per byte, call by call for latency percentiles, then on all
+ * threads at once for scaling; the report is printed as JSON so it
+ * can be stored and compared per commit.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <jansson.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define BENCH_TSC
+#endif
+
+#include "miner.h"
+#include "log.h"
+
+extern void sha256d(unsigned char *hash, const unsigned char *data, int len);
+extern void sha256d_multi(unsigned char *hash, const unsigned char *data, int len, int count);
+
+/* Timed batches per primitive and the minimum length of one */
+#define BENCH_SAMPLES 100
+#define BENCH_BATCH_NS 1000000ULL
+/* Most single calls timed for the latency percentiles */
+#define BENCH_LATENCY_CALLS 1000
+/* Duration of the all threads run */
+#define BENCH_SCALING_NS 1000000000ULL
+
+/* Inputs of the widest neoscrypt_multi() call */
+#define BENCH_LANES 16
+
+struct bench_ctx {
+	uint32_t state[BENCH_LANES * 20];
+	uint32_t target[8];
+	neoscrypt_arena arena;
+	uint64_t calls;
+};
+
+struct bench_item {
+	const char *name;
+	uint32_t bytes;   /* input bytes per call */
+	uint32_t hashes;  /* hashes per call */
+	void (*run)(struct bench_ctx *ctx, uint32_t iterations);
+};
+
+static void bench_salsa(struct bench_ctx *ctx, uint32_t n)
+{
+	neoscrypt_bench(NEOSCRYPT_BENCH_SALSA, n, ctx->state);
+}
+
+static void bench_chacha(struct bench_ctx *ctx, uint32_t n)
+{
+	neoscrypt_bench(NEOSCRYPT_BENCH_CHACHA, n, ctx->state);
+}
+
+static void bench_blake2s(struct bench_ctx *ctx, uint32_t n)
+{
+	neoscrypt_bench(NEOSCRYPT_BENCH_BLAKE2S, n, ctx->state);
+}
+
+static void bench_fastkdf(struct bench_ctx *ctx, uint32_t n)
+{
+	neoscrypt_bench(NEOSCRYPT_BENCH_FASTKDF, n, ctx->state);
+}
+
+static void bench_neoscrypt(struct bench_ctx *ctx, uint32_t n)
+{
+	uchar *data = (uchar *) ctx->state;
+
+	while (n--)
+		neoscrypt(data, data);
+}
+
+static void bench_neoscrypt_multi(struct bench_ctx *ctx, uint32_t n)
+{
+	uchar *data = (uchar *) ctx->state;
+
+	while (n--)
+		neoscrypt_multi(data, data, BENCH_LANES, ctx->arena.mem ? &ctx->arena : NULL);
+}
+
+static void bench_sha256d(struct bench_ctx *ctx, uint32_t n)
+{
+	uchar *data = (uchar *) ctx->state;
+
+	while (n--)
+		sha256d(data, data, 80);
+}
+
+static void bench_sha256d_multi(struct bench_ctx *ctx, uint32_t n)
+{
+	uchar *data = (uchar *) ctx->state;
+
+	while (n--)
+		sha256d_multi(data, data, 80, STRATUM_ROOTS);
+}
+
+static void bench_diff_to_target(struct bench_ctx *ctx, uint32_t n)
+{
+	while (n--)
+		diff_to_target(ctx->target, (double) (++ctx->calls & 0xFFFF) + 1.0);
+}
+
+static void bench_fulltest(struct bench_ctx *ctx, uint32_t n)
+{
+	while (n--)
+		ctx->state[0] += fulltest(&ctx->state[8], ctx->target) ? 1 : 2;
+}
+
+static const struct bench_item bench_items[] = {
+	{ "neoscrypt_salsa",       64, 0, bench_salsa },
+	{ "neoscrypt_chacha",      64, 0, bench_chacha },
+	{ "blake2s_compress",      64, 0, bench_blake2s },
+	{ "neoscrypt_fastkdf_opt", 80, 0, bench_fastkdf },
+	{ "neoscrypt",             80, 1, bench_neoscrypt },
+	{ "neoscrypt_multi",       80 * BENCH_LANES, BENCH_LANES, bench_neoscrypt_multi },
+	{ "sha256d",               80, 1, bench_sha256d },
+	{ "sha256d_multi",         80 * STRATUM_ROOTS, STRATUM_ROOTS, bench_sha256d_multi },
+	{ "diff_to_target",         0, 0, bench_diff_to_target },
+	{ "fulltest",              32, 0, bench_fulltest },
+};
+
+static uint64_t bench_time_ns(void)
+{
+#ifdef WIN32
+	static LARGE_INTEGER freq = { 0 };
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t) ((double) now.QuadPart * 1e9 / (double) freq.QuadPart);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static uint64_t bench_cycles(void)
+{
+#ifdef BENCH_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* Cheapest clock for timing one call: the TSC where there is one */
+static uint64_t bench_stamp(void)
+{
+#ifdef BENCH_TSC
+	return __rdtsc();
+#else
+	return bench_time_ns();
+#endif
+}
+
+/* Times n single calls into lat, sorted, in bench_stamp() ticks less
+ * the cost of reading the clock twice */
+static void bench_latency(const struct bench_item *item, struct bench_ctx *ctx,
+	uint64_t *lat, uint32_t n)
+{
+	uint64_t t, overhead = (uint64_t) -1;
+	uint32_t i;
+
+	for (i = 0; i < 16; i++) {
+		t = bench_stamp();
+		t = bench_stamp() - t;
+		if (t < overhead)
+			overhead = t;
+	}
+
+	for (i = 0; i < n; i++) {
+		t = bench_stamp();
+		item->run(ctx, 1);
+		t = bench_stamp() - t;
+		lat[i] = (t > overhead) ? t - overhead : 0;
+	}
+	std::sort(lat, lat + n);
+}
+
+static void bench_ctx_init(struct bench_ctx *ctx, uint32_t seed)
+{
+	uint32_t i;
+
+	memset(ctx, 0, sizeof(*ctx));
+	for (i = 0; i < BENCH_LANES * 20; i++)
+		ctx->state[i] = seed ^ (i * 0x9E3779B9U);
+	/* A hash at state[8] just below the target */
+	diff_to_target(ctx->target, 1.0);
+	ctx->state[15] = 0;
+	ctx->state[14] = 0x7FFFFFFF;
+	neoscrypt_arena_init(&ctx->arena, opt_hugepages ? NEOSCRYPT_ARENA_HUGE : 0);
+}
+
+/* Calls per batch so that a batch lasts at least BENCH_BATCH_NS */
+static uint32_t bench_calibrate(const struct bench_item *item, struct bench_ctx *ctx)
+{
+	uint32_t n = 1;
+	uint64_t t;
+
+	for (;;) {
+		t = bench_time_ns();
+		item->run(ctx, n);
+		t = bench_time_ns() - t;
+		if (t >= BENCH_BATCH_NS || n >= (1U << 30))
+			return n;
+		n *= 2;
+	}
+}
+
+struct bench_thr {
+	pthread_t pth;
+	const struct bench_item *item;
+	uint32_t batch;
+	uint32_t id;
+	volatile bool *stop;
+	uint64_t calls;
+};
+
+static void *bench_thread(void *userdata)
+{
+	struct bench_thr *thr = (struct bench_thr *) userdata;
+	struct bench_ctx *ctx = (struct bench_ctx *) malloc(sizeof(struct bench_ctx));
+
+	if (!ctx)
+		return NULL;
+	bench_ctx_init(ctx, thr->id + 1);
+	while (!*thr->stop) {
+		thr->item->run(ctx, thr->batch);
+		thr->calls += thr->batch;
+	}
+	neoscrypt_arena_free(&ctx->arena);
+	free(ctx);
+	return NULL;
+}
+
+/* Calls per second of all threads running the primitive at once */
+static double bench_scaling(const struct bench_item *item, uint32_t batch, int threads)
+{
+	struct bench_thr *thr;
+	volatile bool stop = false;
+	uint64_t t, calls = 0;
+	int i, started = 0;
+
+	thr = (struct bench_thr *) calloc(threads, sizeof(struct bench_thr));
+	if (!thr)
+		return 0.0;
+
+	t = bench_time_ns();
+	for (i = 0; i < threads; i++) {
+		thr[i].item = item;
+		thr[i].batch = batch;
+		thr[i].id = i;
+		thr[i].stop = &stop;
+		if (pthread_create(&thr[i].pth, NULL, bench_thread, &thr[i]))
+			break;
+		started++;
+	}
+	while (bench_time_ns() - t < BENCH_SCALING_NS)
+		sleep(1);
+	stop = true;
+	for (i = 0; i < started; i++) {
+		pthread_join(thr[i].pth, NULL);
+		calls += thr[i].calls;
+	}
+	t = bench_time_ns() - t;
+
+	free(thr);
+	return (double) calls * 1e9 / (double) t;
+}
+
+static json_t *bench_one(const struct bench_item *item, int threads)
+{
+	struct bench_ctx *ctx;
+	uint64_t lat[BENCH_LATENCY_CALLS];
+	uint64_t t, c, total_t = 0, total_c = 0, calls;
+	uint32_t batch, nlat;
+	double rate, all, tick_ns = 1.0;
+	json_t *res, *pct, *mt;
+	int i;
+
+	ctx = (struct bench_ctx *) malloc(sizeof(struct bench_ctx));
+	if (!ctx)
+		return NULL;
+	bench_ctx_init(ctx, 0);
+
+	batch = bench_calibrate(item, ctx);
+
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		c = bench_cycles();
+		t = bench_time_ns();
+		item->run(ctx, batch);
+		t = bench_time_ns() - t;
+		c = bench_cycles() - c;
+		total_t += t;
+		total_c += c;
+	}
+
+	/* no more single calls than the batches made, at least 100 */
+	nlat = (batch < BENCH_LATENCY_CALLS / BENCH_SAMPLES) ?
+		batch * BENCH_SAMPLES : BENCH_LATENCY_CALLS;
+	bench_latency(item, ctx, lat, nlat);
+#ifdef BENCH_TSC
+	if (total_c)
+		tick_ns = (double) total_t / (double) total_c;
+#endif
+
+	neoscrypt_arena_free(&ctx->arena);
+	free(ctx);
+
+	calls = (uint64_t) batch * BENCH_SAMPLES;
+	rate = (double) calls * 1e9 / (double) total_t;
+
+	res = json_object();
+	json_object_set_new(res, "name", json_string(item->name));
+	json_object_set_new(res, "calls_per_sec", json_real(rate));
+	if (item->hashes)
+		json_object_set_new(res, "hashes_per_sec", json_real(rate * item->hashes));
+	if (item->bytes && total_c)
+		json_object_set_new(res, "cycles_per_byte",
+			json_real((double) total_c / ((double) calls * item->bytes)));
+
+	/* Latency of the single calls */
+	pct = json_object();
+	json_object_set_new(pct, "calls", json_integer(nlat));
+	json_object_set_new(pct, "p50", json_integer((json_int_t) (lat[nlat * 50 / 100] * tick_ns)));
+	json_object_set_new(pct, "p90", json_integer((json_int_t) (lat[nlat * 90 / 100] * tick_ns)));
+	json_object_set_new(pct, "p99", json_integer((json_int_t) (lat[nlat * 99 / 100] * tick_ns)));
+	json_object_set_new(res, "latency_ns", pct);
+
+	if (threads > 1) {
+		all = bench_scaling(item, batch, threads);
+		mt = json_object();
+		json_object_set_new(mt, "threads", json_integer(threads));
+		json_object_set_new(mt, "calls_per_sec", json_real(all));
+		if (item->hashes)
+			json_object_set_new(mt, "hashes_per_sec", json_real(all * item->hashes));
+		json_object_set_new(mt, "scaling", json_real(all / rate));
+		json_object_set_new(res, "all_threads", mt);
+	}
+
+	return res;
+}
+
+/* Benchmarks every primitive and prints the report to stdout;
+ * returns the process exit code */
+int bench_hashes(void)
+{
+	json_t *report, *results, *res;
+	uint32_t exts = neoscrypt_cpu_exts();
+	int threads = opt_n_threads ? opt_n_threads : num_cpus;
+	char *s;
+	size_t i;
+
+	report = json_object();
+	json_object_set_new(report, "version", json_string(PACKAGE_VERSION));
+	json_object_set_new(report, "engine", json_string(
+		(exts & NEOSCRYPT_EXT_AVX512) ? "AVX-512 x16" :
+		(exts & NEOSCRYPT_EXT_AVX2) ? "AVX2 x8" :
+		(exts & NEOSCRYPT_EXT_SSE2) ? "SSE2 x4" : "scalar"));
+	json_object_set_new(report, "cpus", json_integer(num_cpus));
+#ifdef BENCH_TSC
+	json_object_set_new(report, "cycles", json_string("tsc"));
+#endif
+
+	results = json_array();
+	for (i = 0; i < ARRAY_SIZE(bench_items); i++) {
+		if (!opt_quiet)
+			applog(LOG_DEBUG, "Benchmarking %s", bench_items[i].name);
+		res = bench_one(&bench_items[i], threads);
+		if (!res) {
+			applog(LOG_ERR, "Out of memory benchmarking %s", bench_items[i].name);
+			json_decref(report);
+			json_decref(results);
+			return 1;
+		}
+		json_array_append_new(results, res);
+	}
+	json_object_set_new(report, "results", results);
+
+	s = json_dumps(report, JSON_INDENT(2) | JSON_PRESERVE_ORDER);
+	if (s) {
+		printf("%s\n", s);
+		free(s);
+	}
+	json_decref(report);
+
+	return 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * cudaminer-bench: the --bench-hashes report without the miner
+ *
+ * Links only bench.cpp and the hashing code, so it builds and runs
+ * on machines without CUDA, curl or a pool; the options and the
+ * globals bench.cpp reads are the miner's own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include "miner.h"
+#include "log.h"
+
+extern void sha256_cpu_init(void);
+
+bool opt_debug = false;
+bool opt_quiet = false;
+bool opt_hugepages = false;
+int opt_n_threads = 0;
+int num_cpus = 1;
+
+void applog(int prio, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (prio == LOG_DEBUG && !opt_debug)
+		return;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-t N] [--huge-pages] [-D] [-q]\n\
+  -t, --threads=N   threads of the scaling run (default: number of cpus)\n\
+      --huge-pages  back the NeoScrypt scratch with huge pages\n\
+  -D, --debug       log every primitive as it is benchmarked\n\
+  -q, --quiet       no log output\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (!strcmp(arg, "-t") && i + 1 < argc)
+			opt_n_threads = atoi(argv[++i]);
+		else if (!strncmp(arg, "--threads=", 10))
+			opt_n_threads = atoi(&arg[10]);
+		else if (!strcmp(arg, "--huge-pages"))
+			opt_hugepages = true;
+		else if (!strcmp(arg, "-D") || !strcmp(arg, "--debug"))
+			opt_debug = true;
+		else if (!strcmp(arg, "-q") || !strcmp(arg, "--quiet"))
+			opt_quiet = true;
+		else {
+			usage(argv[0]);
+			return strcmp(arg, "-h") && strcmp(arg, "--help") ? 1 : 0;
+		}
+	}
+	if (opt_n_threads < 0)
+		opt_n_threads = 0;
+
+#if defined(WIN32)
+	SYSTEM_INFO sysinfo;
+	GetSystemInfo(&sysinfo);
+	num_cpus = sysinfo.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_CONF)
+	num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+#endif
+	if (num_cpus < 1)
+		num_cpus = 1;
+
+	sha256_cpu_init();
+
+	return bench_hashes();
+}
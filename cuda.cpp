@@ -27,6 +27,10 @@ extern int opt_api_listen;
 int cuda_num_devices()
 {
 	int version;
+
+	if (opt_virtual_gpus)
+		return opt_virtual_gpus;
+
 	cudaError_t err = cudaDriverGetVersion(&version);
 	if (err != cudaSuccess)
 	{
@@ -55,6 +59,15 @@ void cuda_devicenames()
 {
 	cudaError_t err;
 	int GPU_N;
+
+	if (opt_virtual_gpus) {
+		for (int i = 0; i < opt_virtual_gpus*opt_n_gputhreads; i++) {
+			device_name[i] = strdup("Virtual GPU");
+			device_sm[i] = 0;
+		}
+		return;
+	}
+
 	err = cudaGetDeviceCount(&GPU_N);
 	if (err != cudaSuccess)
 	{
@@ -79,14 +92,20 @@ void cuda_print_devices()
 	for (int n = 0; n < ngpus; n++) {
 		int m = device_map[n % MAX_GPUS];
 		cudaDeviceProp props;
-		cudaGetDeviceProperties(&props, m);
-		if (!opt_n_threads || n < opt_n_threads) {
-			fprintf(stderr, "GPU #%d: SM %d.%d %s\n", m, props.major, props.minor, device_name[n]);
+		if (opt_n_threads && n >= opt_n_threads)
+			continue;
+		if (opt_virtual_gpus) {
+			fprintf(stderr, "GPU #%d: %s\n", m, device_name[n]);
+			continue;
 		}
+		cudaGetDeviceProperties(&props, m);
+		fprintf(stderr, "GPU #%d: SM %d.%d %s\n", m, props.major, props.minor, device_name[n]);
 	}
 }
 
 void cuda_shutdown() {
+    if (opt_virtual_gpus)
+        return;
     cudaDeviceSynchronize();
     cudaDeviceReset();
 }
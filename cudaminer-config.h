@@ -59,6 +59,12 @@
 /* Define to 1 if you have the <sys/endian.h> header file. */
 /* #undef HAVE_SYS_ENDIAN_H */
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#define HAVE_SYS_EPOLL_H 1
+
+/* Define to 1 if you have the <sys/eventfd.h> header file. */
+#define HAVE_SYS_EVENTFD_H 1
+
 /* Define to 1 if you have the <sys/param.h> header file. */
 #define HAVE_SYS_PARAM_H 1
 
@@ -115,6 +121,12 @@
 /* Define to 1 if AVX2 assembly is available. */
 #define USE_AVX2 1
 
+/* Define to 1 if AVX-512 assembly is available. */
+#define USE_AVX512 1
+
+/* Define to 1 if SHA assembly is available. */
+#define USE_SHA 1
+
 /* Define to 1 if XOP assembly is available. */
 #define USE_XOP 1
 
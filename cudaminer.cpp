@@ -57,6 +57,10 @@ BOOL WINAPI ConsoleHandler(DWORD);
 #endif
 
 extern void sha256d(unsigned char *hash, const unsigned char *data, int len);
+extern void sha256_cpu_init(void);
+extern void sha256d_multi(unsigned char *hash, const unsigned char *data, int len, int count);
+extern void sha256d_multi_mid(unsigned char *hash, const uint32_t *midstate,
+	const unsigned char *data, int len, int total, int count);
 
 #define PROGRAM_NAME "cudaminer"
 #define LP_SCANTIME 30
@@ -118,6 +122,7 @@ static int opt_fail_pause = 5;
 static int opt_time_limit = 0;
 int opt_timeout = 270;
 static int opt_scantime = 5;
+static int opt_ntime_roll = 0;
 static json_t *opt_config;
 static const bool opt_time = true;
 static enum sha_algos opt_algo = ALGO_NEOSCRYPT;
@@ -125,6 +130,13 @@ int opt_n_threads = 0;
 int opt_n_gputhreads = 1;
 int opt_affinity = -1;
 int opt_priority = 0;
+bool opt_cpumining = false;
+bool opt_hugepages = false;
+bool opt_selftest = false;
+bool opt_autotune = false;
+int opt_virtual_gpus = 0;
+char *opt_tune_cache = (char *) "cudaminer-tune.json";
+static bool opt_benchhashes = false;
 static bool opt_extranonce = true;
 int gpu_threads = 1;
 
@@ -164,9 +176,20 @@ struct thr_api *thr_api = NULL;
 int longpoll_thr_id = -1;
 int stratum_thr_id = -1;
 int api_thr_id = -1;
-bool stratum_need_reset = false;
 struct work_restart *work_restart = NULL;
-struct stratum_ctx stratum = { 0 };
+/* Pools in the order of preference, the one of -o first; the miner
+ * threads get their work from the one stratum points to, which is
+ * only switched with g_work_lock held */
+static struct stratum_ctx pools[MAX_POOLS];
+static int num_pools = 1;
+static int stratum_threads = 0;
+static int opt_pool_timeout = 90;
+/* --ntime-roll given after -o or a --backup-url is for that pool only,
+ * the other pools use opt_ntime_roll */
+static int pool_opt_last = -1;
+static int pool_ntime_roll[MAX_POOLS];
+static bool pool_ntime_set[MAX_POOLS];
+static struct stratum_ctx *stratum = &pools[0];
 
 static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 uint32_t accepted_count = 0L;
@@ -196,6 +219,9 @@ Options:\n\
   -d, --devices         comma separated list of CUDA devices to use \n\
   -i, --intensity=N     GPU intensity 8-31 (default: auto) \n\
   -m, --mode=N          internal hashing mode (1 to 3, default depends on GPU)\n\
+      --auto-tune       time the hashing modes and intensities on the first\n\
+                          start and use the fastest, kept in the tuning cache\n\
+      --tune-cache=FILE tuning cache (default: cudaminer-tune.json)\n\
   -o, --url=URL         URL of mining server\n\
   -O, --userpass=U:P    username:password pair for mining server\n\
   -u, --user=USERNAME   username for mining server\n\
@@ -204,13 +230,28 @@ Options:\n\
   -x, --proxy=[PROTOCOL://]HOST[:PORT]  connect through a proxy\n\
   -t, --threads=N       number of GPU mining threads (default: number of GPUs)\n\
   -g, --gputhreads=N    number of threads per GPU (default: 1)\n\
+      --cpu-mining      mine on the CPU instead of CUDA devices, -t sets\n\
+                          the number of threads (default: number of CPUs)\n\
+      --huge-pages      back CPU mining scratch memory with huge pages\n\
+      --virtual-gpus=N  emulate N CUDA devices on the CPU, for testing without\n\
+                          a GPU or driver\n\
   -r, --retries=N       number of times to retry if a network call fails\n\
                           (default: retry indefinitely)\n\
   -R, --retry-pause=N   time to pause between retries, in seconds (default: 30)\n\
+      --backup-url=URL  stratum pool to mine on while the ones before it are\n\
+                          down or not answering, may be given up to 7 times;\n\
+                          the URL may carry a user:pass@ of its own\n\
+      --pool-timeout=N  seconds before mining on the next pool when one stops\n\
+                          answering: a keepalive probe is sent after N/2 s\n\
+                          without a line and has N/2 s to be answered\n\
+                          (default: 90)\n\
       --time-limit      maximum time [s] to mine before exiting the program.\n\
   -T, --timeout=N       network timeout, in seconds (default: 270)\n\
   -s, --scantime=N      upper bound on time spent scanning current work when\n\
                           long polling is unavailable, in seconds (default: 5)\n\
+      --ntime-roll=N    roll ntime up to N seconds past the pool time to get\n\
+                          new nonce ranges without a new merkle root (default: 0, off);\n\
+                          after -o or a --backup-url it is for that pool only\n\
   -n, --ndevs           list CUDA devices\n\
   -N, --statsavg        number of samples used to display hash rate (default: 30)\n\
       --no-gbt          disable getblocktemplate support (height check in solo)\n\
@@ -226,6 +267,10 @@ Options:\n\
   -S, --syslog          use system log for output messages\n\
   -B, --background      run the miner in the background\n\
   --benchmark           run in offline benchmark mode\n\
+      --selftest        check the hash functions against known answers before\n\
+                          mining, exits afterwards if no URL is given\n\
+      --bench-hashes    time the hashing primitives on the CPU, print a JSON\n\
+                          report and exit, -t sets the threads for scaling\n\
   -c, --config=FILE     load a JSON-format configuration file\n\
   -V, --version         display version information and exit\n\
   -h, --help            display this help text and exit\n\
@@ -235,13 +280,18 @@ char const short_options[] = "b:c:d:g:hi:m:no:p:qr:s:t:u:x:BDN:O:P:R:S:T:V";
 
 struct option const options[] = {
 	{ "api-bind", 1, NULL, 'b' },
+	{ "auto-tune", 0, NULL, 1027 },
+	{ "backup-url", 1, NULL, 1030 },
+	{ "bench-hashes", 0, NULL, 1025 },
 	{ "benchmark", 0, NULL, 1005 },
 	{ "cert", 1, NULL, 1001 },
 	{ "config", 1, NULL, 'c' },
 	{ "cpu-affinity", 1, NULL, 1020 },
+	{ "cpu-mining", 0, NULL, 1022 },
 	{ "cpu-priority", 1, NULL, 1021 },
 	{ "debug", 0, NULL, 'D' },
 	{ "help", 0, NULL, 'h' },
+	{ "huge-pages", 0, NULL, 1023 },
 	{ "intensity", 1, NULL, 'i' },
 	{ "mode", 1, NULL, 'm' },
 	{ "ndevs", 0, NULL, 'n' },
@@ -249,7 +299,9 @@ struct option const options[] = {
 	{ "no-gbt", 0, NULL, 1011 },
 	{ "no-longpoll", 0, NULL, 1003 },
 	{ "no-stratum", 0, NULL, 1007 },
+	{ "ntime-roll", 1, NULL, 1026 },
 	{ "pass", 1, NULL, 'p' },
+	{ "pool-timeout", 1, NULL, 1031 },
 	{ "protocol-dump", 0, NULL, 'P' },
 	{ "proxy", 1, NULL, 'x' },
 	{ "quiet", 0, NULL, 'q' },
@@ -257,9 +309,11 @@ struct option const options[] = {
 	{ "retry-pause", 1, NULL, 'R' },
 	{ "syslog", 0, NULL, 'S' },
 	{ "scantime", 1, NULL, 's' },
+	{ "selftest", 0, NULL, 1024 },
 	{ "statsavg", 1, NULL, 'N' },
 	{ "time-limit", 1, NULL, 1008 },
 	{ "threads", 1, NULL, 't' },
+	{ "tune-cache", 1, NULL, 1028 },
 	{ "gputhreads", 1, NULL, 'g' },
 	{ "gpu-engine", 1, NULL, 1070 },
 	{ "gpu-memclock", 1, NULL, 1071 },
@@ -268,6 +322,7 @@ struct option const options[] = {
 	{ "user", 1, NULL, 'u' },
 	{ "userpass", 1, NULL, 'O' },
 	{ "version", 0, NULL, 'V' },
+	{ "virtual-gpus", 1, NULL, 1029 },
 	{ "devices", 1, NULL, 'd' },
 	{ 0, 0, 0, 0 }
 };
@@ -276,6 +331,31 @@ static struct work _ALIGN(64) g_work;
 static time_t g_work_time;
 static pthread_mutex_t g_work_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Stratum works generated ahead for every miner thread, each with its
+ * own extranonce2, so a GPU done with its range never waits for the
+ * merkle root of the next one; flushed as a whole on a new job */
+#define WORK_QUEUE_DEPTH 4
+
+struct work_queue {
+	pthread_mutex_t lock;
+	struct work work[WORK_QUEUE_DEPTH];
+	int head;
+	int count;
+	volatile uint32_t gen;   /* bumped on every flush */
+	/* private job copy the works are generated from */
+	struct stratum_job job;
+	size_t xnonce2_size;
+	int pooln;               /* pool of the job, set on flush */
+	uint32_t job_gen;
+	bool have_job;
+};
+
+static struct work_queue *work_queues = NULL;
+static int pregen_thr_id = -1;
+static pthread_mutex_t pregen_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pregen_cond = PTHREAD_COND_INITIALIZER;
+static bool pregen_pending = false;
+
 
 #ifdef __linux__
 #include <sched.h>
@@ -289,40 +369,67 @@ static inline void drop_policy(void) {
 		sched_setscheduler(0, SCHED_BATCH, &param);
 #endif
 }
-static void affine_to_cpu_mask(int id, uint8_t mask) {
-	cpu_set_t set;
-	CPU_ZERO(&set);
-	for (uint8_t i = 0; i < num_cpus; i++) {
-		// cpu mask
-		if (mask & (1<<i)) { CPU_SET(i, &set); }
-	}
+static void affine_to_cpu_set(int id, cpu_set_t *set) {
+	int err;
 	if (id == -1) {
 		// process affinity
-		sched_setaffinity(0, sizeof(&set), &set);
+		err = sched_setaffinity(0, sizeof(*set), set) ? errno : 0;
 	} else {
 		// thread only
-		pthread_setaffinity_np(thr_info[id].pth, sizeof(&set), &set);
+		err = pthread_setaffinity_np(thr_info[id].pth, sizeof(*set), set);
 	}
+	if (err)
+		applog(LOG_WARNING, "Unable to set cpu affinity: %s", strerror(err));
+}
+static void affine_to_cpu_mask(int id, unsigned long mask) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int i = 0; i < num_cpus && i < (int) sizeof(mask) * 8; i++) {
+		// cpu mask
+		if (mask & (1UL << i)) { CPU_SET(i, &set); }
+	}
+	affine_to_cpu_set(id, &set);
+}
+/* pin a thread to one cpu by index, not limited by the mask width */
+static void affine_to_cpu(int id, int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	affine_to_cpu_set(id, &set);
 }
 #elif defined(__FreeBSD__) /* FreeBSD specific policy and affinity management */
 #include <sys/cpuset.h>
 static inline void drop_policy(void) { }
-static void affine_to_cpu_mask(int id, uint8_t mask) {
+static void affine_to_cpu_mask(int id, unsigned long mask) {
 	cpuset_t set;
 	CPU_ZERO(&set);
-	for (uint8_t i = 0; i < num_cpus; i++) {
-		if (mask & (1<<i)) CPU_SET(i, &set);
+	for (int i = 0; i < num_cpus && i < (int) sizeof(mask) * 8; i++) {
+		if (mask & (1UL << i)) CPU_SET(i, &set);
 	}
 	cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_TID, -1, sizeof(cpuset_t), &set);
 }
+static void affine_to_cpu(int id, int cpu) {
+	cpuset_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_TID, -1, sizeof(cpuset_t), &set);
+}
 #else /* Windows */
 static inline void drop_policy(void) { }
-static void affine_to_cpu_mask(int id, uint8_t mask) {
+static void affine_to_cpu_mask(int id, unsigned long mask) {
 	if (id == -1)
 		SetProcessAffinityMask(GetCurrentProcess(), mask);
 	else
 		SetThreadAffinityMask(GetCurrentThread(), mask);
 }
+static void affine_to_cpu(int id, int cpu) {
+	if (cpu >= (int) sizeof(DWORD_PTR) * 8)
+		return; /* beyond the first processor group */
+	if (id == -1)
+		SetProcessAffinityMask(GetCurrentProcess(), (DWORD_PTR)1 << cpu);
+	else
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+}
 #endif
 
 static bool get_blocktemplate(CURL *curl, struct work *work);
@@ -350,7 +457,8 @@ void proper_exit(int reason) {
 
     abort_flag = true;
     usleep(200 * 1000);
-    cuda_shutdown();
+    if(!opt_cpumining)
+      cuda_shutdown();
 
     if((reason == EXIT_CODE_OK) && (app_exit_code != EXIT_CODE_OK))
       reason = app_exit_code;
@@ -455,7 +563,8 @@ static void calc_diff(struct work *work, int known)
 	work->difficulty = (double)diffone / d64;
 }
 
-static int share_result(int result, const char *reason) {
+/* Credits the answer to a share to the thread that found it */
+static int share_result(int result, int thr_id, uint32_t msec, const char *reason) {
     char s[32];
 	double hashrate = 0.;
 	const char *sres;
@@ -467,6 +576,7 @@ static int share_result(int result, const char *reason) {
 	}
 
 	result ? accepted_count++ : rejected_count++;
+	result ? thr_info[thr_id].gpu.accepted++ : thr_info[thr_id].gpu.rejected++;
 	pthread_mutex_unlock(&stats_lock);
 
 #if (_MSC_VER < 1800)
@@ -481,9 +591,9 @@ static int share_result(int result, const char *reason) {
       sres = (result ? "(yes!)" : "(no)");
 
     sprintf(s, hashrate >= 1e6 ? "%.0f" : "%.2f", hashrate / 1000.0);
-    applog(LOG_NOTICE, "accepted: %lu/%lu (%.2f%%), %s KH/s %s",
+    gpulog(LOG_NOTICE, thr_id, "accepted: %lu/%lu (%.2f%%), %s KH/s, %u ms %s",
       accepted_count, accepted_count + rejected_count,
-      100. * accepted_count / (accepted_count + rejected_count), s, sres);
+      100. * accepted_count / (accepted_count + rejected_count), s, msec, sres);
 
 	if (reason) {
 		applog(LOG_WARNING, "reject reason: %s", reason);
@@ -497,8 +607,9 @@ static int share_result(int result, const char *reason) {
 	return 1;
 }
 
-static bool submit_upstream_work(CURL *curl, struct work *work)
+static bool submit_upstream_work(CURL *curl, struct work *work, int thr_id)
 {
+	struct timeval tv_sent, tv_answer, diff;
 	json_t *val, *res, *reason;
 	bool stale_work = false;
 	char s[384];
@@ -533,9 +644,22 @@ static bool submit_upstream_work(CURL *curl, struct work *work)
 
 	if (have_stratum) 
 	{
+		struct stratum_ctx *sctx = &pools[work->pooln];
 		uint32_t sent = 0;
         uint32_t ntime, nonce;
+        int id;
         char *ntimestr, *noncestr, *xnonce2str;
+		bool gone;
+
+		/* the job went away with the connection of a pool failed over from */
+		pthread_mutex_lock(&g_work_lock);
+		gone = sctx != stratum && !sctx->curl;
+		pthread_mutex_unlock(&g_work_lock);
+		if (gone) {
+			if (!opt_quiet)
+				applog(LOG_WARNING, "pool %d is down, share dropped", sctx->pooln);
+			return true;
+		}
 
         if(opt_algo != ALGO_NEOSCRYPT) {
             le32enc(&ntime, work->data[17]);
@@ -557,7 +681,9 @@ static bool submit_upstream_work(CURL *curl, struct work *work)
 			}
 			free(noncestr);
 			// prevent useless computing on some pools
-			stratum_need_reset = true;
+			sctx->need_reset = true;
+			if (sctx->loop)
+				net_loop_wake(sctx->loop);
             restart_threads();
 
 			return true;
@@ -566,17 +692,18 @@ static bool submit_upstream_work(CURL *curl, struct work *work)
 		ntimestr = bin2hex((const uchar*)(&ntime), 4);
 		xnonce2str = bin2hex(work->xnonce2, work->xnonce2_len);
 
-		{
-			sprintf(s,
-				"{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":4}",
-				rpc_user, work->job_id + 8, xnonce2str, ntimestr, noncestr);
-		}
+		/* recorded before sending, the answer may come back any time */
+		id = stratum_submit_add(sctx, thr_id, work->job_id + 8, work->data[19]);
+		sprintf(s,
+			"{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":%d}",
+			sctx->user ? sctx->user : rpc_user, work->job_id + 8, xnonce2str, ntimestr, noncestr, id);
 		free(xnonce2str);
 		free(ntimestr);
 		free(noncestr);
 
-		gettimeofday(&stratum.tv_submit, NULL);
-		if (unlikely(!stratum_send_line(&stratum, s))) {
+		if (unlikely(!stratum_send_line(sctx, s))) {
+			struct stratum_submit sub;
+			stratum_submit_take(sctx, id, &sub);
 			applog(LOG_ERR, "submit_upstream_work stratum_send_line failed");
 			sleep(10);
 			return false;
@@ -609,15 +736,20 @@ static bool submit_upstream_work(CURL *curl, struct work *work)
 			str);
 
 		/* issue JSON-RPC request */
+		gettimeofday(&tv_sent, NULL);
 		val = json_rpc_call(curl, rpc_url, rpc_userpass, s, false, false, NULL);
 		if (unlikely(!val)) {
 			applog(LOG_ERR, "submit_upstream_work json_rpc_call failed");
 			return false;
 		}
+		gettimeofday(&tv_answer, NULL);
+		timeval_subtract(&diff, &tv_answer, &tv_sent);
 
 		res = json_object_get(val, "result");
 		reason = json_object_get(val, "reject-reason");
-		if (!share_result(json_is_true(res), reason ? json_string_value(reason) : NULL)) {
+		if (!share_result(json_is_true(res), thr_id,
+		    (uint32_t) (1000 * diff.tv_sec + diff.tv_usec / 1000),
+		    reason ? json_string_value(reason) : NULL)) {
 			if (check_dups)
 				hashlog_purge_job(work->job_id);
 		}
@@ -788,7 +920,7 @@ static bool workio_submit_work(struct workio_cmd *wc, CURL *curl)
 	int failures = 0;
 
 	/* submit solution to bitcoin via JSON-RPC */
-	while (!submit_upstream_work(curl, wc->u.work)) {
+	while (!submit_upstream_work(curl, wc->u.work, wc->thr->id)) {
 		if (unlikely((opt_retries >= 0) && (++failures > opt_retries))) {
 			applog(LOG_ERR, "...terminating workio thread");
 			return false;
@@ -917,77 +1049,330 @@ err_out:
 	return false;
 }
 
-static void stratum_gen_work(struct stratum_ctx *sctx, struct work *work)
+static void stratum_inc_xnonce2(uchar *xnonce2, size_t size)
 {
-	uchar merkle_root[64];
-	int i;
+	size_t i;
 
-	if (!sctx->job.job_id) {
-		// applog(LOG_WARNING, "stratum_gen_work: job not yet retrieved");
-		return;
+	for (i = 0; i < size && !++xnonce2[i]; i++);
+}
+
+/* Merkle roots of the coinbase with xnonce2 and the STRATUM_ROOTS - 1
+ * values following it, hashed in one sha256d_multi() pass per level;
+ * the coinbase blocks before xnonce2 come from the job midstate.
+ * Only the low roll bytes of xnonce2 are incremented */
+static bool stratum_gen_roots(struct stratum_job *job, size_t xnonce2_size, size_t roll)
+{
+	size_t size = job->coinbase_size - job->midstate_size;
+	size_t xn2 = job->xnonce2 - job->coinbase - job->midstate_size;
+	uchar *tails, *tail;
+	uchar level[STRATUM_ROOTS][64];
+	int i, k;
+
+	tails = (uchar*) malloc(STRATUM_ROOTS * size);
+	if (!tails)
+		return false;
+
+	for (k = 0; k < STRATUM_ROOTS; k++) {
+		tail = tails + k * size;
+		memcpy(tail, job->coinbase + job->midstate_size, size);
+		if (k) {
+			memcpy(tail + xn2, tail - size + xn2, xnonce2_size);
+			stratum_inc_xnonce2(tail + xn2, roll);
+		}
+	}
+	sha256d_multi_mid(job->roots[0], job->midstate, tails, (int)size,
+		(int)job->coinbase_size, STRATUM_ROOTS);
+	free(tails);
+
+	for (i = 0; i < job->merkle_count; i++) {
+		for (k = 0; k < STRATUM_ROOTS; k++) {
+			memcpy(level[k], job->roots[k], 32);
+			memcpy(level[k] + 32, job->merkle[i], 32);
+		}
+		sha256d_multi(job->roots[0], level[0], 64, STRATUM_ROOTS);
 	}
 
-	pthread_mutex_lock(&sctx->work_lock);
+	job->roots_left = STRATUM_ROOTS;
+	return true;
+}
+
+/* Work of the current xnonce2 of a job, then moves xnonce2 on;
+ * the caller owns the job */
+static void stratum_job_work(struct stratum_job *job, size_t xnonce2_size, size_t roll,
+	struct work *work)
+{
+	uchar merkle_root[64];
+	int i;
 
 	// store the job ntime as high part of jobid
 	snprintf(work->job_id, sizeof(work->job_id), "%07x %s",
-		be32dec(sctx->job.ntime) & 0xfffffff, sctx->job.job_id);
-	work->xnonce2_len = sctx->xnonce2_size;
-	memcpy(work->xnonce2, sctx->job.xnonce2, sctx->xnonce2_size);
+		be32dec(job->ntime) & 0xfffffff, job->job_id);
+	work->xnonce2_len = xnonce2_size;
+	memcpy(work->xnonce2, job->xnonce2, xnonce2_size);
 
 	// also store the bloc number
-	work->height = sctx->job.height;
+	work->height = job->height;
 
     /* Generate merkle root */
-    sha256d(merkle_root, sctx->job.coinbase, (uint)sctx->job.coinbase_size);
-    for(i = 0; i < sctx->job.merkle_count; i++) {
-        memcpy(merkle_root + 32, sctx->job.merkle[i], 32);
-        sha256d(merkle_root, merkle_root, 64);
+    if (job->roots_left || stratum_gen_roots(job, xnonce2_size, roll)) {
+        memcpy(merkle_root, job->roots[STRATUM_ROOTS - job->roots_left], 32);
+        job->roots_left--;
+    } else {
+        sha256d_multi_mid(merkle_root, job->midstate,
+            job->coinbase + job->midstate_size,
+            (int)(job->coinbase_size - job->midstate_size),
+            (int)job->coinbase_size, 1);
+        for(i = 0; i < job->merkle_count; i++) {
+            memcpy(merkle_root + 32, job->merkle[i], 32);
+            sha256d(merkle_root, merkle_root, 64);
+        }
     }
 
-//	/+Increment extranonce2 +/
-
-	for (i = 0; i < (int)sctx->xnonce2_size && !++sctx->job.xnonce2[i]; i++);
-	{
-		sctx->job.xnonce2[i]++;		
-	}
+	/* Increment extranonce2 */
+	stratum_inc_xnonce2(job->xnonce2, roll);
 
     /* Assemble block header;
      * reverse byte order for NeoScrypt */
     memset(work->data, 0, 128);
     if(opt_algo != ALGO_NEOSCRYPT) {
-        work->data[0] = le32dec(sctx->job.version);
+        work->data[0] = le32dec(job->version);
         for(i = 0; i < 8; i++)
-          work->data[1 + i] = le32dec((uint32_t *) sctx->job.prevhash + i);
+          work->data[1 + i] = le32dec((uint32_t *) job->prevhash + i);
         for(i = 0; i < 8; i++)
           work->data[9 + i] = be32dec((uint32_t *) merkle_root + i);
-        work->data[17] = le32dec(sctx->job.ntime);
-        work->data[18] = le32dec(sctx->job.nbits);
+        work->data[17] = le32dec(job->ntime);
+        work->data[18] = le32dec(job->nbits);
     } else {
-        work->data[0] = be32dec(sctx->job.version);
+        work->data[0] = be32dec(job->version);
         for(i = 0; i < 8; i++)
-          work->data[1 + i] = be32dec((uint32_t *) sctx->job.prevhash + i);
+          work->data[1 + i] = be32dec((uint32_t *) job->prevhash + i);
         for(i = 0; i < 8; i++)
           work->data[9 + i] = le32dec((uint32_t *) merkle_root + i);
-        work->data[17] = be32dec(sctx->job.ntime);
-        work->data[18] = be32dec(sctx->job.nbits);
+        work->data[17] = be32dec(job->ntime);
+        work->data[18] = be32dec(job->nbits);
     }
     work->data[20] = 0x80000000;
     work->data[31] = 0x00000280;
 
-	pthread_mutex_unlock(&sctx->work_lock);
+    /* NeoScrypt */
+    diff_to_target(work->target, job->diff / 65536.0);
+}
 
+static void stratum_debug_work(struct stratum_ctx *sctx, struct work *work)
+{
 	if (opt_debug) {
 		char *tm = atime2str(swab32(work->data[17]) - sctx->srvtime_diff);
-		char *xnonce2str = bin2hex(work->xnonce2, sctx->xnonce2_size);
+		char *xnonce2str = bin2hex(work->xnonce2, work->xnonce2_len);
 		applog(LOG_DEBUG, "DEBUG: job_id=%s xnonce2=%s time=%s",
 		       work->job_id, xnonce2str, tm);
 		free(tm);
 		free(xnonce2str);
 	}
+}
 
-    /* NeoScrypt */
-    diff_to_target(work->target, sctx->job.diff / 65536.0);
+static void stratum_gen_work(struct stratum_ctx *sctx, struct work *work)
+{
+	if (!sctx->job.job_id) {
+		// applog(LOG_WARNING, "stratum_gen_work: job not yet retrieved");
+		return;
+	}
+
+	pthread_mutex_lock(&sctx->work_lock);
+	stratum_job_work(&sctx->job, sctx->xnonce2_size, sctx->xnonce2_size, work);
+	pthread_mutex_unlock(&sctx->work_lock);
+	work->pooln = sctx->pooln;
+
+	stratum_debug_work(sctx, work);
+}
+
+static void stratum_job_free(struct stratum_job *job)
+{
+	free(job->job_id);
+	free(job->coinbase);
+	free(job->merkle);
+	memset(job, 0, sizeof(*job));
+}
+
+/* Deep copy of a stratum job, the merkle branches in one allocation */
+static bool stratum_job_copy(struct stratum_job *dst, const struct stratum_job *src)
+{
+	int i;
+
+	stratum_job_free(dst);
+	memcpy(dst, src, sizeof(*dst));
+	dst->job_id = strdup(src->job_id);
+	dst->coinbase = (uchar*) malloc(src->coinbase_size);
+	dst->merkle = (uchar**) malloc(src->merkle_count * (sizeof(uchar*) + 32) + 1);
+	if (!dst->job_id || !dst->coinbase || !dst->merkle) {
+		stratum_job_free(dst);
+		return false;
+	}
+
+	memcpy(dst->coinbase, src->coinbase, src->coinbase_size);
+	dst->xnonce2 = dst->coinbase + (src->xnonce2 - src->coinbase);
+	for (i = 0; i < src->merkle_count; i++) {
+		dst->merkle[i] = (uchar*) (dst->merkle + src->merkle_count) + 32 * i;
+		memcpy(dst->merkle[i], src->merkle[i], 32);
+	}
+	dst->roots_left = 0;
+
+	return true;
+}
+
+static void pregen_wakeup(void)
+{
+	pthread_mutex_lock(&pregen_lock);
+	pregen_pending = true;
+	pthread_cond_signal(&pregen_cond);
+	pthread_mutex_unlock(&pregen_lock);
+}
+
+/* Drops the queued works of all miner threads, called by the stratum
+ * thread with g_work_lock held once the new job is in stratum->job;
+ * the queues take the pool from here, not from stratum */
+static void work_queues_flush(void)
+{
+	int i;
+
+	if (!work_queues)
+		return;
+
+	for (i = 0; i < opt_n_threads; i++) {
+		pthread_mutex_lock(&work_queues[i].lock);
+		work_queues[i].count = 0;
+		work_queues[i].gen++;
+		work_queues[i].pooln = stratum->pooln;
+		pthread_mutex_unlock(&work_queues[i].lock);
+	}
+	pregen_wakeup();
+}
+
+/* Moves the ntime of a work one second on if it then stays within
+ * ntime_roll seconds of the pool time, which gives a new nonce range
+ * without building a new merkle root */
+static bool stratum_roll_ntime(struct stratum_ctx *sctx, struct work *work)
+{
+	uint32_t ntime, limit;
+
+	if (!sctx->ntime_roll)
+		return false;
+
+	ntime = (opt_algo == ALGO_NEOSCRYPT) ? work->data[17] : swab32(work->data[17]);
+	limit = (uint32_t) time(NULL) + sctx->srvtime_diff + sctx->ntime_roll;
+	if (ntime >= limit)
+		return false;
+
+	ntime++;
+	work->data[17] = (opt_algo == ALGO_NEOSCRYPT) ? ntime : swab32(ntime);
+	return true;
+}
+
+/* Whether every miner thread can own a slice of an extranonce2 of
+ * xnonce2_size bytes: the top byte selects the slice, so there must be
+ * bytes below it to roll and no more threads than top byte values */
+static bool work_queue_slices(size_t xnonce2_size)
+{
+	return xnonce2_size > 1 && opt_n_threads <= 256;
+}
+
+/* Next work of miner thread thr_id from its own copy of the stratum
+ * job, refreshed once per queue generation. Every thread owns the
+ * slice of the extranonce2 space selected by the top byte and rolls
+ * the bytes below it, so no lock is shared with the other threads.
+ * Without room for the slices the threads share the extranonce2 of
+ * the pool job under its lock instead.
+ * Called with the queue lock held */
+static bool work_queue_gen(int thr_id, struct work *work)
+{
+	struct work_queue *q = &work_queues[thr_id];
+	struct stratum_ctx *sctx;
+	size_t size;
+
+	if (!q->have_job || q->job_gen != q->gen) {
+		sctx = &pools[q->pooln];
+		pthread_mutex_lock(&sctx->work_lock);
+		q->have_job = sctx->job.job_id && stratum_job_copy(&q->job, &sctx->job);
+		q->xnonce2_size = sctx->xnonce2_size;
+		pthread_mutex_unlock(&sctx->work_lock);
+		if (!q->have_job)
+			return false;
+		q->job_gen = q->gen;
+
+		memset(q->job.xnonce2, 0, q->xnonce2_size);
+		if (work_queue_slices(q->xnonce2_size))
+			q->job.xnonce2[q->xnonce2_size - 1] = (uchar) (thr_id * 256 / opt_n_threads);
+	}
+
+	size = q->xnonce2_size;
+	sctx = &pools[q->pooln];
+	if (work_queue_slices(size))
+		stratum_job_work(&q->job, size, size - 1, work);
+	else {
+		/* the next extranonce2 of the pool job, as for g_work */
+		pthread_mutex_lock(&sctx->work_lock);
+		q->have_job = sctx->job.job_id && sctx->xnonce2_size == size;
+		if (q->have_job)
+			stratum_job_work(&sctx->job, size, size, work);
+		pthread_mutex_unlock(&sctx->work_lock);
+		if (!q->have_job)
+			return false;
+	}
+	work->pooln = q->pooln;
+	stratum_debug_work(sctx, work);
+
+	return true;
+}
+
+/* Next work of a miner thread; generated inline if the pregen thread
+ * did not keep up. gen is set to the queue generation it belongs to */
+static void work_queue_pop(int thr_id, struct work *work, uint32_t *gen)
+{
+	struct work_queue *q = &work_queues[thr_id];
+
+	pthread_mutex_lock(&q->lock);
+	*gen = q->gen;
+	if (q->count) {
+		memcpy(work, &q->work[q->head], sizeof(struct work));
+		q->head = (q->head + 1) % WORK_QUEUE_DEPTH;
+		q->count--;
+	} else
+		work_queue_gen(thr_id, work);
+	pthread_mutex_unlock(&q->lock);
+
+	pregen_wakeup();
+}
+
+static void *pregen_thread(void *userdata)
+{
+	struct work_queue *q;
+	bool idle;
+	int i;
+
+	while (!abort_flag) {
+		pthread_mutex_lock(&pregen_lock);
+		while (!pregen_pending && !abort_flag)
+			pthread_cond_wait(&pregen_cond, &pregen_lock);
+		pregen_pending = false;
+		pthread_mutex_unlock(&pregen_lock);
+
+		/* no pool to mine on */
+		pthread_mutex_lock(&g_work_lock);
+		idle = !g_work_time;
+		pthread_mutex_unlock(&g_work_lock);
+		if (idle)
+			continue;
+
+		for (i = 0; i < opt_n_threads && !abort_flag; i++) {
+			q = &work_queues[i];
+			pthread_mutex_lock(&q->lock);
+			while (q->count < WORK_QUEUE_DEPTH &&
+			       work_queue_gen(i, &q->work[(q->head + q->count) % WORK_QUEUE_DEPTH]))
+				q->count++;
+			pthread_mutex_unlock(&q->lock);
+		}
+	}
+
+	return NULL;
 }
 
 static void *miner_thread(void *userdata)
@@ -997,15 +1382,28 @@ static void *miner_thread(void *userdata)
 	struct work work;
 	uint64_t loopcnt = 0;
 	uint32_t max_nonce;
-	uint32_t end_nonce = 0xffffffffU / opt_n_threads * (thr_id + 1) - (thr_id + 1);
+	/* stratum works have an extranonce2 of their own per thread */
+	uint32_t end_nonce = have_stratum ? UINT32_MAX :
+		0xffffffffU / opt_n_threads * (thr_id + 1) - (thr_id + 1);
 	time_t firstwork_time = 0;
 	bool work_done = false;
 	bool extrajob = false;
+	struct work *next_work = &g_work;
+	uint32_t work_gen = 0;
+	uint32_t nonces[MAX_NONCES];
+	int i;
 	char s[16];
 	int rc = 0;
 
 	memset(&work, 0, sizeof(work)); // prevent work from being used uninitialized
 
+	/* stratum works come from the own queue, see pregen_thread() */
+	if (have_stratum) {
+		next_work = (struct work *) calloc(1, sizeof(struct work));
+		if (!next_work)
+			goto out;
+	}
+
 	/* Set worker threads to nice 19 and then preferentially to SCHED_IDLE
 	 * and if that fails, then SCHED_BATCH. No need for this to be an
 	 * error if it fails */
@@ -1046,7 +1444,14 @@ static void *miner_thread(void *userdata)
 	/* Cpu thread affinity */
 	if (num_cpus > 1) 
 	{
-		if (opt_affinity == -1) 
+		if (opt_affinity == -1 && opt_cpumining)
+		{
+			/* CPU workers: one per core, wrapping when oversubscribed */
+			if (!opt_quiet)
+				applog(LOG_DEBUG, "Binding thread %d to cpu %d", thr_id,
+				thr_id%num_cpus);
+			affine_to_cpu(thr_id, thr_id%num_cpus);
+		} else if (opt_affinity == -1) 
 		{
 			if (!opt_quiet)
 				applog(LOG_DEBUG, "Binding thread %d to cpu %d (mask %x)", thr_id,
@@ -1096,12 +1501,16 @@ static void *miner_thread(void *userdata)
 				applog(LOG_DEBUG, "sleeptime: %u ms", sleeptime * 100);
 			}
 				nonceptr = (uint32_t*) (((char*)work.data) + wcmplen);
-			pthread_mutex_lock(&g_work_lock);
+			/* a restart from here on interrupts the next scan */
+			work_restart[thr_id].restart = 0;
 			extrajob |= work_done;
-			if (nonceptr[0] >= end_nonce || extrajob) {
+			if (nonceptr[0] >= end_nonce || extrajob || work_gen != work_queues[thr_id].gen) {
+				/* a range done on a current job may go on with the next ntime */
+				if (extrajob || work_gen != work_queues[thr_id].gen ||
+				    !stratum_roll_ntime(&pools[next_work->pooln], next_work))
+					work_queue_pop(thr_id, next_work, &work_gen);
 				work_done = false;
 				extrajob = false;
-				stratum_gen_work(&stratum, &g_work);
 			}
 		} else 
 		{
@@ -1120,43 +1529,48 @@ static void *miner_thread(void *userdata)
 			}
 		}
 
-		if (!opt_benchmark && (g_work.height != work.height || memcmp(work.target, g_work.target, sizeof(work.target))))
+		if (!opt_benchmark && (next_work->height != work.height || memcmp(work.target, next_work->target, sizeof(work.target))))
 		{
-			calc_diff(&g_work, 0);
+			calc_diff(next_work, 0);
 			if (!have_stratum)
-				global_diff = g_work.difficulty;
+				global_diff = next_work->difficulty;
 			if (opt_debug) {
-				uint64_t target64 = g_work.target[7] * 0x100000000ULL + g_work.target[6];
-				applog(LOG_DEBUG, "job %s target change: %llx (%.1f)", g_work.job_id, target64, g_work.difficulty);
+				uint64_t target64 = next_work->target[7] * 0x100000000ULL + next_work->target[6];
+				applog(LOG_DEBUG, "job %s target change: %llx (%.1f)", next_work->job_id, target64, next_work->difficulty);
 			}
-			memcpy(work.target, g_work.target, sizeof(work.target));
-			work.difficulty = g_work.difficulty;
-			work.height = g_work.height;
+			memcpy(work.target, next_work->target, sizeof(work.target));
+			work.difficulty = next_work->difficulty;
+			work.height = next_work->height;
 			/* on new target, ignoring nonce, clear sent data (hashlog) */
-			if (memcmp(work.target, g_work.target, sizeof(work.target))) {
+			if (memcmp(work.target, next_work->target, sizeof(work.target))) {
 				if (check_dups)
 					hashlog_purge_job(work.job_id);
 			}
 		}
-		if (memcmp(work.data, g_work.data, wcmplen)) {
+		if (memcmp(work.data, next_work->data, wcmplen)) {
 			#if 0
 			if (opt_debug) {
 				for (int n=0; n <= (wcmplen-8); n+=8) {
-					if (memcmp(work.data + n, g_work.data + n, 8)) {
-						applog(LOG_DEBUG, "job %s work updated at offset %d:", g_work.job_id, n);
+					if (memcmp(work.data + n, next_work->data + n, 8)) {
+						applog(LOG_DEBUG, "job %s work updated at offset %d:", next_work->job_id, n);
 						applog_hash((uchar*) &work.data[n]);
-						applog_compare_hash((uchar*) &g_work.data[n], (uchar*) &work.data[n]);
+						applog_compare_hash((uchar*) &next_work->data[n], (uchar*) &work.data[n]);
 					}
 				}
 			}
 			#endif
-			memcpy(&work, &g_work, sizeof(struct work));
-			nonceptr[0] = (UINT32_MAX / opt_n_threads) * thr_id; // 0 if single thr
+			memcpy(&work, next_work, sizeof(struct work));
+			if (have_stratum)
+				nonceptr[0] = 0;
+			else
+				nonceptr[0] = (UINT32_MAX / opt_n_threads) * thr_id; // 0 if single thr
 		} else
 			nonceptr[0]++; //??
 
-		work_restart[thr_id].restart = 0;
-		pthread_mutex_unlock(&g_work_lock);
+		if (!have_stratum) {
+			work_restart[thr_id].restart = 0;
+			pthread_mutex_unlock(&g_work_lock);
+		}
 
 		/* prevent gpu scans before a job is received */
 		if ((have_stratum && work.data[0] == 0 || network_fail_flag) && !opt_benchmark)
@@ -1201,8 +1615,8 @@ static void *miner_thread(void *userdata)
 		
         if(max64 < minmax) {
 
-            /* NeoScrypt */
-            minmax = 0x2000000;
+            /* NeoScrypt; CPU threads are orders of magnitude slower */
+            minmax = opt_cpumining ? 0x4000 : 0x2000000;
 
             max64 = max(minmax - 1, max64);
         }
@@ -1239,7 +1653,12 @@ static void *miner_thread(void *userdata)
 		gettimeofday(&tv_start, NULL);
 
         /* NeoScrypt */
-        rc = scanhash_neoscrypt(thr_id, work.data, work.target, max_nonce, &hashes_done, hash_mode);
+        if(opt_cpumining)
+          rc = scanhash_neoscrypt_cpu(thr_id, work.data, work.target, max_nonce, &hashes_done,
+            nonces);
+        else
+          rc = scanhash_neoscrypt(thr_id, work.data, work.target, max_nonce, &hashes_done, hash_mode,
+            nonces);
 
 		/* record scanhash elapsed time */
 		gettimeofday(&tv_end, NULL);
@@ -1247,10 +1666,8 @@ static void *miner_thread(void *userdata)
 		if (firstwork_time == 0)
 			firstwork_time = time(NULL);
 
-		if (rc && opt_debug)
-			applog(LOG_NOTICE, CL_CYN "found => %08x" CL_GRN " %08x", nonceptr[0], swab32(nonceptr[0])); // data[19]
-		if (rc > 1 && opt_debug)
-			applog(LOG_NOTICE, CL_CYN "found => %08x" CL_GRN " %08x", nonceptr[2], swab32(nonceptr[2])); // data[21]
+		for (i = 0; i < rc && opt_debug; i++)
+			applog(LOG_NOTICE, CL_CYN "found => %08x" CL_GRN " %08x", nonces[i], swab32(nonces[i]));
 
 		timeval_subtract(&diff, &tv_end, &tv_start);
 
@@ -1307,7 +1724,11 @@ static void *miner_thread(void *userdata)
 				hashrate = thr_hashrates[thr_id];
 			}
 			if (hashrate == 0.0) writelog = false;
-			if (writelog)
+			if (writelog && opt_cpumining)
+			{
+				applog(LOG_INFO, "CPU #%d: %*.f", thr_id, (hashrate > 1e6) ? 0 : 2, 1e-3 * hashrate);
+			}
+			else if (writelog)
 			{
 #ifdef USE_WRAPNVML
 				if (hnvml != NULL) {
@@ -1372,21 +1793,30 @@ static void *miner_thread(void *userdata)
 				continue;
 			}
 
-			// second nonce found, submit too (on pool only!)
-			if (rc > 1 && work.data[21]) {
-				work.data[19] = work.data[21];
-				work.data[21] = 0;
+			// more nonces found, submit too (on pool only!)
+			for (i = 1; i < rc; i++) {
+				work.data[19] = nonces[i];
 				if (!submit_work(mythr, &work))
 					break;
 			}
+			if (i < rc)
+				break;
 		}
         work.data[19] = start_nonce + (uint)hashes_done;
 		loopcnt++;
 	}
 
+	if (have_stratum)
+		free(next_work);
+	if (!opt_cpumining)
+		scanhash_neoscrypt_free(thr_id);
 	return NULL;
 
 out:
+	if (have_stratum)
+		free(next_work);
+	if (!opt_cpumining)
+		scanhash_neoscrypt_free(thr_id);
 	tq_freeze(mythr->q);
 
 	return NULL;
@@ -1485,11 +1915,12 @@ out:
 	return NULL;
 }
 
-static bool stratum_handle_response(char *buf)
+static bool stratum_handle_response(struct stratum_ctx *sctx, char *buf)
 {
 	json_t *val, *err_val, *res_val, *id_val;
 	json_error_t err;
 	struct timeval tv_answer, diff;
+	struct stratum_submit sub;
 	bool ret = false;
 
 	val = JSON_LOADS(buf, &err);
@@ -1502,20 +1933,28 @@ static bool stratum_handle_response(char *buf)
 	err_val = json_object_get(val, "error");
 	id_val = json_object_get(val, "id");
 
-	if (!id_val || json_is_null(id_val) || !res_val)
+	if (!id_val || json_is_null(id_val))
 		goto out;
 
-	// ignore subscribe late answer (yaamp)
-	if (json_integer_value(id_val) < 4)
+	if (stratum_probe_answer(sctx, (int) json_integer_value(id_val))) {
+		ret = true;
+		goto out;
+	}
+	if (!res_val)
+		goto out;
+
+	// ignore subscribe late answer (yaamp) and shares lost on a reconnect
+	if (!stratum_submit_take(sctx, (int) json_integer_value(id_val), &sub))
 		goto out;
 
 	gettimeofday(&tv_answer, NULL);
-	timeval_subtract(&diff, &tv_answer, &stratum.tv_submit);
+	timeval_subtract(&diff, &tv_answer, &sub.tv_sent);
 	// store time required to the pool to answer to a submit
-	stratum.answer_msec = (1000 * diff.tv_sec) + (uint32_t) (0.001 * diff.tv_usec);
+	sctx->answer_msec = (1000 * diff.tv_sec) + (uint32_t) (0.001 * diff.tv_usec);
 
-	share_result(json_is_true(res_val),
-		err_val ? json_string_value(json_array_get(err_val, 1)) : NULL);
+	if (!share_result(json_is_true(res_val), sub.thr_id, sctx->answer_msec,
+		err_val ? json_string_value(json_array_get(err_val, 1)) : NULL) && opt_debug)
+		applog(LOG_DEBUG, "rejected share: job %s nonce %08x", sub.job_id, sub.nonce);
 
 	ret = true;
 out:
@@ -1525,87 +1964,163 @@ out:
 	return ret;
 }
 
+/* The pool mined on, held until stratum_unlock() so that a failover
+ * can not switch it meanwhile; for the API */
+struct stratum_ctx *stratum_lock(void)
+{
+	pthread_mutex_lock(&g_work_lock);
+	return stratum;
+}
+
+void stratum_unlock(void)
+{
+	pthread_mutex_unlock(&g_work_lock);
+}
+
+/* Half of the pool timeout is spent silent before the probe is sent,
+ * the other half waiting for its answer */
+#define pool_probe_ms() ((uint64_t) opt_pool_timeout * 500)
+
+/* Fails over to another pool when the current one is down or leaves
+ * its keepalive probe unanswered, and regenerates g_work when the pool
+ * mined on has a new job; called by the pool threads after every line
+ * and change of connection */
+static void stratum_check_job(void)
+{
+	struct stratum_ctx *sctx, *old;
+	bool switched = false, changed, clean;
+
+	pthread_mutex_lock(&g_work_lock);
+	old = stratum;
+	sctx = stratum_switch(pools, num_pools, &stratum, net_time_ms(), pool_probe_ms());
+	if (!sctx) {
+		/* nothing to mine on, regenerate once a pool is back */
+		if (g_work_time) {
+			g_work_time = 0;
+			restart_threads();
+		}
+		pthread_mutex_unlock(&g_work_lock);
+		return;
+	}
+
+	if (sctx != old) {
+		network_fail_flag = false;
+		switched = true;
+	}
+
+	pthread_mutex_lock(&sctx->work_lock);
+	changed = sctx->job.job_id && (switched || !g_work_time ||
+		strncmp(sctx->job.job_id, g_work.job_id + 8, 120));
+	clean = sctx->job.clean;
+	pthread_mutex_unlock(&sctx->work_lock);
+
+	if (changed) {
+		stratum_gen_work(sctx, &g_work);
+		g_work_time = time(NULL);
+		work_queues_flush();
+		if (clean || switched)
+		{
+			network_fail_flag = false;
+			if (!opt_quiet)
+				applog(LOG_BLUE, "%s %s block %d", pool_short_url(sctx), algo_names[opt_algo],
+					sctx->job.height);
+			restart_threads();
+			if (check_dups)
+				hashlog_purge_old();
+			stats_purge_old();
+		} else if (opt_debug && !opt_quiet) {
+				applog(LOG_BLUE, "%s asks job %d for block %d", pool_short_url(sctx),
+					strtoul(sctx->job.job_id, NULL, 16), sctx->job.height);
+		}
+	}
+	pthread_mutex_unlock(&g_work_lock);
+}
+
+/* One per pool, the backup ones stay connected and authorized so that
+ * a failover only waits for stratum_check_job().
+ * Connects and does the handshake with blocking calls, then runs the
+ * connection from its own network loop: the socket is non-blocking,
+ * submits are queued by stratum_send_line() and sent as the socket
+ * takes them, every line received is handled as soon as it is complete */
 static void *stratum_thread(void *userdata)
 {
 	struct thr_info *mythr = (struct thr_info *)userdata;
-	char *s;
+	struct stratum_ctx *sctx;
+	struct net_loop loop;
 
-	stratum.url = (char*)tq_pop(mythr->q, NULL);
-	if (!stratum.url)
+	sctx = (struct stratum_ctx *)tq_pop(mythr->q, NULL);
+	if (!sctx)
 		goto out;
-	applog(LOG_BLUE, "Starting Stratum on %s", stratum.url);
+	applog(LOG_BLUE, "Starting Stratum on %s", sctx->url);
+
+	if (!net_loop_init(&loop)) {
+		applog(LOG_ERR, "Unable to set up the network loop");
+		goto out;
+	}
 
 	while (!abort_flag) {
 		int failures = 0;
 
-		if (stratum_need_reset) {
-			stratum_need_reset = false;
-			stratum_disconnect(&stratum);
+		if (sctx->need_reset) {
+			sctx->need_reset = false;
+			stratum_disconnect(sctx);
 			applog(LOG_DEBUG, "stratum connection reset");
 		}
 
-		while (!stratum.curl && !abort_flag) {
-			pthread_mutex_lock(&g_work_lock);
-			g_work_time = 0;
-			pthread_mutex_unlock(&g_work_lock);
-			restart_threads();
+		while (!sctx->curl && !abort_flag) {
+			/* fail over right away, the GPUs only wait
+			 * when no other pool is usable */
+			stratum_check_job();
+
+			if (!stratum_connect(sctx, sctx->url) ||
+			    !stratum_subscribe(sctx) ||
+			    !stratum_authorize(sctx, sctx->user ? sctx->user : rpc_user,
+				sctx->pass ? sctx->pass : rpc_pass, opt_extranonce)) {
+				stratum_disconnect(sctx);
 
-			if (!stratum_connect(&stratum, stratum.url) ||
-			    !stratum_subscribe(&stratum) ||
-			    !stratum_authorize(&stratum, rpc_user, rpc_pass,opt_extranonce)) {
-				stratum_disconnect(&stratum);
-				network_fail_flag = true;
+				pthread_mutex_lock(&g_work_lock);
+				if (!stratum_pick(pools, num_pools, stratum, net_time_ms(), pool_probe_ms()))
+					network_fail_flag = true;
+				pthread_mutex_unlock(&g_work_lock);
 
 				if (opt_retries >= 0 && ++failures > opt_retries) {
-					applog(LOG_ERR, "...terminating workio thread");
-					tq_push(thr_info[work_thr_id].q, NULL);
-					abort_flag = true;
-					goto out;
+					bool last;
+
+					pthread_mutex_lock(&g_work_lock);
+					last = !--stratum_threads;
+					pthread_mutex_unlock(&g_work_lock);
+					if (last) {
+						applog(LOG_ERR, "...terminating workio thread");
+						tq_push(thr_info[work_thr_id].q, NULL);
+						abort_flag = true;
+					} else
+						applog(LOG_ERR, "...giving up on pool %d", sctx->pooln);
+					goto done;
 				}
 				if (!opt_benchmark)
 					applog(LOG_ERR, "...retry after %d seconds", opt_fail_pause);
 				sleep(opt_fail_pause);
 			}
 		}
+		if (abort_flag)
+			break;
 
-		if (stratum.job.job_id &&
-		    (!g_work_time || strncmp(stratum.job.job_id, g_work.job_id + 8, 120))) {
-			pthread_mutex_lock(&g_work_lock);
-			stratum_gen_work(&stratum, &g_work);
-			g_work_time = time(NULL);
-			if (stratum.job.clean) 
-			{
-				network_fail_flag = false;
-				if (!opt_quiet)
-					applog(LOG_BLUE, "%s %s block %d", short_url, algo_names[opt_algo],
-						stratum.job.height);
-				restart_threads();
-				if (check_dups)
-					hashlog_purge_old();
-				stats_purge_old();
-			} else if (opt_debug && !opt_quiet) {
-					applog(LOG_BLUE, "%s asks job %d for block %d", short_url,
-						strtoul(stratum.job.job_id, NULL, 16), stratum.job.height);
-			}
-			pthread_mutex_unlock(&g_work_lock);
-		}
-		
-		if (!stratum_socket_full(&stratum, 120)) {
-			applog(LOG_ERR, "Stratum connection timed out");
-			s = NULL;
-		} else
-			s = stratum_recv_line(&stratum);
-		if (!s) {
-			stratum_disconnect(&stratum);
-			applog(LOG_ERR, "Stratum connection interrupted");
+		if (!sctx->loop && !stratum_loop_start(sctx, &loop)) {
+			applog(LOG_ERR, "Stratum connection not usable");
+			stratum_disconnect(sctx);
 			continue;
 		}
-		if (!stratum_handle_method(&stratum, s))
-			stratum_handle_response(s);
-		free(s);
+
+		/* the next lines, the keepalive and the queued sends; the
+		 * connection is set up again above once it is dropped */
+		stratum_loop_step(sctx, &loop, pool_probe_ms(), stratum_handle_response,
+			stratum_check_job);
 	}
 
-	stratum_disconnect(&stratum);
+done:
+	stratum_disconnect(sctx);
+	stratum_check_job();
+	net_loop_free(&loop);
 
 out:
 	return NULL;
@@ -1809,6 +2324,7 @@ static void parse_arg(int key, char *arg)
 			short_url = p + 1;
 		}
 		have_stratum = !opt_benchmark && !strncasecmp(rpc_url, "stratum", 7);
+		pool_opt_last = 0;
 		break;
 	case 'O':			/* --userpass */
 		p = strchr(arg, ':');
@@ -1886,6 +2402,73 @@ static void parse_arg(int key, char *arg)
 			show_usage_and_exit(1);
 		opt_priority = v;
 		break;
+	case 1022:
+		opt_cpumining = true;
+		break;
+	case 1023:
+		opt_hugepages = true;
+		break;
+	case 1024:
+		opt_selftest = true;
+		break;
+	case 1025:
+		opt_benchhashes = true;
+		break;
+	case 1026:
+		v = atoi(arg);
+		if (v < 0 || v > 7200)	/* sanity check */
+			show_usage_and_exit(1);
+		if (pool_opt_last < 0)
+			opt_ntime_roll = v;
+		else {
+			pool_ntime_roll[pool_opt_last] = v;
+			pool_ntime_set[pool_opt_last] = true;
+		}
+		break;
+	case 1027:
+		opt_autotune = true;
+		break;
+	case 1028:
+		opt_tune_cache = strdup(arg);
+		break;
+	case 1029:
+		v = atoi(arg);
+		if (v < 1 || v > MAX_GPUS)	/* sanity check */
+			show_usage_and_exit(1);
+		opt_virtual_gpus = v;
+		break;
+	case 1030: /* --backup-url */
+		{
+			struct stratum_ctx *sctx = &pools[num_pools];
+			char *ap = arg + 14, *sp;
+
+			if (num_pools == MAX_POOLS || strncasecmp(arg, "stratum+tcp://", 14))
+				show_usage_and_exit(1);
+			sctx->url = (char*)malloc(strlen(arg) + 1);
+			p = strrchr(arg, '@');
+			if (p) {
+				sp = strchr(ap, ':');
+				if (sp && sp < p) {
+					sctx->user = (char*)calloc(sp - ap + 1, 1);
+					strncpy(sctx->user, ap, sp - ap);
+					sctx->pass = (char*)calloc(p - sp, 1);
+					strncpy(sctx->pass, sp + 1, p - sp - 1);
+				} else {
+					sctx->user = (char*)calloc(p - ap + 1, 1);
+					strncpy(sctx->user, ap, p - ap);
+				}
+				sprintf(sctx->url, "stratum+tcp://%s", p + 1);
+			} else
+				strcpy(sctx->url, arg);
+			pool_opt_last = num_pools++;
+		}
+		break;
+	case 1031: /* --pool-timeout */
+		v = atoi(arg);
+		if (v < 1 || v > 9999)	/* sanity check */
+			show_usage_and_exit(1);
+		opt_pool_timeout = v;
+		break;
 	case 'd': // CB
 		{
 			int ngpus = cuda_num_devices();
@@ -1980,7 +2563,7 @@ static void parse_arg(int key, char *arg)
  */
 static void parse_config(void)
 {
-	int i;
+	int i, last = pool_opt_last;
 	json_t *val;
 
 	if (!json_is_object(opt_config))
@@ -1993,6 +2576,9 @@ static void parse_config(void)
 		if (!strcmp(options[i].name, "config"))
 			continue;
 
+		/* top level options are for every pool */
+		pool_opt_last = -1;
+
 		val = json_object_get(opt_config, options[i].name);
 		if (!val)
 			continue;
@@ -2014,6 +2600,27 @@ static void parse_config(void)
 			sprintf(buf, "%f", json_real_value(val));
 			parse_arg(options[i].val, buf);
 		}
+		else if (options[i].has_arg && json_is_array(val)) {
+			/* an option given several times, e.g. backup-url; a pool
+			 * may also be an object with a "url" and its own options */
+			size_t n;
+			for (n = 0; n < json_array_size(val); n++) {
+				json_t *elem = json_array_get(val, n);
+				json_t *url = json_is_object(elem) ? json_object_get(elem, "url") : elem;
+				json_t *roll = json_is_object(elem) ? json_object_get(elem, "ntime-roll") : NULL;
+				char *s = json_is_string(url) ? strdup(json_string_value(url)) : NULL;
+				if (!s)
+					continue;
+				parse_arg(options[i].val, s);
+				free(s);
+				if (json_is_integer(roll)) {
+					char buf[16];
+					sprintf(buf, "%d", (int) json_integer_value(roll));
+					parse_arg(1026, buf);
+				}
+				pool_opt_last = -1;
+			}
+		}
 		else if (!options[i].has_arg) {
 			if (json_is_true(val))
 				parse_arg(options[i].val, (char*) "");
@@ -2022,6 +2629,7 @@ static void parse_config(void)
 			applog(LOG_ERR, "JSON option %s invalid",
 				options[i].name);
 	}
+	pool_opt_last = last;
 }
 
 static void parse_cmdline(int argc, char *argv[])
@@ -2148,11 +2756,27 @@ int main(int argc, char *argv[])
 #else
 	num_cpus = 1;
 #endif
+
+	/* pick the hashing backends of this CPU before any thread hashes */
+	sha256_cpu_init();
+	/* CPU mining, the hash benchmarks and virtual GPUs must be known
+	 * before the CUDA driver is queried, there may be no driver at all */
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--cpu-mining") || !strcmp(argv[i], "--bench-hashes"))
+			opt_cpumining = true;
+		else if (!strncmp(argv[i], "--virtual-gpus=", 15))
+			opt_virtual_gpus = atoi(argv[i] + 15);
+		else if (!strcmp(argv[i], "--virtual-gpus") && i + 1 < argc)
+			opt_virtual_gpus = atoi(argv[i + 1]);
+	}
+	if (opt_virtual_gpus < 0 || opt_virtual_gpus > MAX_GPUS)
+		opt_virtual_gpus = 0;
+
 	// number of gpus
-	active_gpus = cuda_num_devices();
+	active_gpus = opt_cpumining ? 0 : cuda_num_devices();
 
 
-	if (active_gpus > 1)
+	if (active_gpus > 1 || opt_cpumining)
 	{
 		// default thread to device map
 		for (i = 0; i < MAX_GPUS; i++)
@@ -2168,12 +2792,23 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	cuda_devicenames();
+	if (!opt_cpumining)
+		cuda_devicenames();
 
 	/* parse command line */
 	parse_cmdline(argc, argv);
 	if (abort_flag) return 0;
 
+	if (opt_selftest) {
+		if (!hash_selftest())
+			return 1;
+		if (!opt_benchmark && !rpc_url && !opt_benchhashes)
+			return 0;
+	}
+
+	if (opt_benchhashes)
+		return bench_hashes();
+
 	if (!opt_benchmark && !rpc_url) {
 		fprintf(stderr, "%s: no URL supplied\n", argv[0]);
 		show_usage_and_exit(1);
@@ -2187,10 +2822,18 @@ int main(int argc, char *argv[])
 	}
 
 	/* init stratum data.. */
-	memset(&stratum.url, 0, sizeof(stratum));
+	memset(&pools[0], 0, sizeof(pools[0]));
 
-	pthread_mutex_init(&stratum.sock_lock, NULL);
-	pthread_mutex_init(&stratum.work_lock, NULL);
+	if (num_pools > 1 && (opt_benchmark || strncasecmp(rpc_url, "stratum", 7))) {
+		applog(LOG_WARNING, "backup pools need a stratum URL, ignored");
+		num_pools = 1;
+	}
+	for (i = 0; i < num_pools; i++) {
+		pools[i].pooln = i;
+		pthread_mutex_init(&pools[i].sock_lock, NULL);
+		pthread_mutex_init(&pools[i].work_lock, NULL);
+		pthread_mutex_init(&pools[i].submit_lock, NULL);
+	}
 
 	flags = !opt_benchmark && rpc_url && strncmp(rpc_url, "https:", 6)
 	      ? (CURL_GLOBAL_ALL & ~CURL_GLOBAL_SSL)
@@ -2282,7 +2925,17 @@ int main(int argc, char *argv[])
 			applog(LOG_DEBUG, "Binding process to cpu mask %x", opt_affinity);
 		affine_to_cpu_mask(-1, opt_affinity);
 	}
-	if (active_gpus == 0) {
+	if (opt_cpumining) {
+		if (!opt_n_threads)
+			opt_n_threads = num_cpus;
+		/* per thread stats are sized for MAX_GPUS */
+		if (opt_n_threads > MAX_GPUS)
+			opt_n_threads = MAX_GPUS;
+		applog(LOG_INFO, "CPU mining, NeoScrypt engine %s",
+			(neoscrypt_cpu_exts() & NEOSCRYPT_EXT_AVX512) ? "AVX-512 x16" :
+			(neoscrypt_cpu_exts() & NEOSCRYPT_EXT_AVX2) ? "AVX2 x8" :
+			(neoscrypt_cpu_exts() & NEOSCRYPT_EXT_SSE2) ? "SSE2 x4" : "scalar");
+	} else if (active_gpus == 0) {
 		applog(LOG_ERR, "No CUDA devices found! terminating.");
 		exit(1);
 	}
@@ -2320,7 +2973,8 @@ int main(int argc, char *argv[])
 	if (!work_restart)
 		return 1;
 
-	thr_info = (struct thr_info *)calloc(opt_n_threads + 4, sizeof(*thr));
+	/* the threads of the backup pools come after the pregen one */
+	thr_info = (struct thr_info *)calloc(opt_n_threads + 4 + num_pools, sizeof(*thr));
 	if (!thr_info)
 		return 1;
 
@@ -2354,29 +3008,60 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (have_stratum) {
+		work_queues = (struct work_queue *)calloc(opt_n_threads, sizeof(*work_queues));
+		if (!work_queues)
+			return 1;
+		for (i = 0; i < opt_n_threads; i++)
+			pthread_mutex_init(&work_queues[i].lock, NULL);
+	}
+
 	if (want_stratum) {
 		/* init stratum thread info */
 		stratum_thr_id = opt_n_threads + 2;
-		thr = &thr_info[stratum_thr_id];
-		thr->id = stratum_thr_id;
-		thr->q = tq_new();
-		if (!thr->q)
-			return 1;
+		pools[0].url = strdup(rpc_url);
+		for (i = 0; i < (have_stratum ? num_pools : 1); i++) {
+			thr = &thr_info[i ? opt_n_threads + 4 + i : stratum_thr_id];
+			thr->id = i ? opt_n_threads + 4 + i : stratum_thr_id;
+			thr->q = tq_new();
+			if (!thr->q)
+				return 1;
+
+			if (have_stratum)
+				stratum_threads++;
+
+			/* start stratum thread */
+			if (unlikely(pthread_create(&thr->pth, NULL, stratum_thread, thr))) {
+				applog(LOG_ERR, "stratum thread create failed");
+				return 1;
+			}
 
-		/* start stratum thread */
-		if (unlikely(pthread_create(&thr->pth, NULL, stratum_thread, thr))) {
-			applog(LOG_ERR, "stratum thread create failed");
-			return 1;
+			if (have_stratum)
+				tq_push(thr->q, &pools[i]);
 		}
+	}
 
-		if (have_stratum)
-			tq_push(thr_info[stratum_thr_id].q, strdup(rpc_url));
+	if (have_stratum) {
+		for (i = 0; i < num_pools; i++)
+			pools[i].ntime_roll = pool_ntime_set[i] ? pool_ntime_roll[i] : opt_ntime_roll;
+
+		/* init work pregeneration thread info */
+		pregen_thr_id = opt_n_threads + 4;
+		thr = &thr_info[pregen_thr_id];
+		thr->id = pregen_thr_id;
+
+		/* start work pregeneration thread */
+		if (unlikely(pthread_create(&thr->pth, NULL, pregen_thread, thr))) {
+			applog(LOG_ERR, "work pregeneration thread create failed");
+			return 1;
+		}
 	}
 
 #ifdef USE_WRAPNVML
 #ifndef WIN32
 	/* nvml is currently not the best choice on Windows (only in x64) */
-	hnvml = nvml_create();
+	if (!opt_virtual_gpus)
+		hnvml = nvml_create();
 	if (hnvml)
 		applog(LOG_INFO, "NVML GPU monitoring enabled.");
 #else
@@ -0,0 +1,53 @@
+/**
+ * "make check" test of the CPU hashing code
+ *
+ * Runs hash_selftest_cpu() without starting the miner: the known
+ * answers, then random inputs through every optimised path against
+ * the reference neoscrypt(). An optional argument gives the seed of
+ * the random inputs, to replay a failure.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "miner.h"
+#include "log.h"
+
+extern void sha256_cpu_init(void);
+
+/* selftest.cpp reports through applog(), which lives in the miner */
+void applog(int prio, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t seed = (uint32_t) time(NULL);
+	uint exts;
+
+	sha256_cpu_init();
+	exts = neoscrypt_cpu_exts();
+
+	if (argc > 1)
+		seed = (uint32_t) strtoul(argv[1], NULL, 16);
+
+	printf("NeoScrypt engine %s, seed %08x\n",
+		(exts & NEOSCRYPT_EXT_AVX512) ? "AVX-512 x16" :
+		(exts & NEOSCRYPT_EXT_AVX2) ? "AVX2 x8" :
+		(exts & NEOSCRYPT_EXT_SSE2) ? "SSE2 x4" : "scalar", seed);
+
+	if (!hash_selftest_cpu(seed)) {
+		printf("FAIL\n");
+		return 1;
+	}
+
+	printf("PASS\n");
+	return 0;
+}
@@ -48,6 +48,7 @@ typedef unsigned long long uint64_t;
 #endif
 
 #include "cudaminer-config.h"
+#include "netloop.h"
 
 #include <sys/time.h>
 #include <pthread.h>
@@ -294,8 +295,17 @@ void aligned_free(void *ptr);
 
 #define USER_AGENT PACKAGE_NAME "/" PACKAGE_VERSION
 
+/* Candidate nonces one scanhash call may return; they are stored to
+ * nonces[], the first one also to pdata[19], and their number returned */
+#define MAX_NONCES 16
+
 extern int scanhash_neoscrypt(int thr_id, uint32_t *pdata,
-  const uint32_t *ptarget, uint32_t max_nonce, uint64_t *hashes_done, uint hash_mode);
+  const uint32_t *ptarget, uint32_t max_nonce, uint64_t *hashes_done, uint hash_mode,
+  uint32_t *nonces);
+extern int scanhash_neoscrypt_cpu(int thr_id, uint32_t *pdata,
+  const uint32_t *ptarget, uint32_t max_nonce, uint64_t *hashes_done,
+  uint32_t *nonces);
+extern void scanhash_neoscrypt_free(int thr_id);
 
 /* api related */
 void *api_thread(void *userdata);
@@ -386,6 +396,11 @@ extern bool opt_tracegpu;
 extern int opt_n_threads;
 extern int opt_n_gputhreads;
 extern bool opt_cpumining;
+extern bool opt_hugepages;
+extern bool opt_selftest;
+extern bool opt_autotune;
+extern int opt_virtual_gpus;
+extern char *opt_tune_cache;
 extern int num_cpus;
 extern int active_gpus;
 extern int opt_timeout;
@@ -433,12 +448,37 @@ extern void diff_to_target(uint32_t *target, double diff);
 extern void get_currentalgo(char* buf, int sz);
 extern uint32_t device_intensity(int thr_id, const char *func, uint32_t defcount);
 
+/* Merkle roots generated ahead per stratum job, one sha256d_multi() batch */
+#define STRATUM_ROOTS 8
+
+/* Stratum receive buffer, the longest line accepted from a pool */
+#define STRATUM_RBUF_SIZE (64 * 1024)
+
+/* Shares sent and not answered yet, matched to the answers by id;
+ * ids below STRATUM_SUBMIT_ID are taken by the handshake */
+#define STRATUM_MAX_SUBMITS 64
+#define STRATUM_SUBMIT_ID 4
+
+/* The pool of -o and the backup ones, see --backup-url */
+#define MAX_POOLS 8
+
+struct stratum_submit {
+	int id;			/* 0 when the slot is free */
+	int thr_id;
+	uint32_t nonce;
+	char job_id[64];
+	struct timeval tv_sent;
+};
+
 struct stratum_job {
 	char *job_id;
 	unsigned char prevhash[32];
 	size_t coinbase_size;
 	unsigned char *coinbase;
 	unsigned char *xnonce2;
+	/* SHA-256 state of the coinbase blocks before xnonce2 */
+	uint32_t midstate[8];
+	size_t midstate_size;
 	int merkle_count;
 	unsigned char **merkle;
 	unsigned char version[4];
@@ -448,18 +488,34 @@ struct stratum_job {
 	unsigned char nreward[2];
 	uint32_t height;
 	double diff;
+	/* roots of xnonce2 and the values following it */
+	int roots_left;
+	unsigned char roots[STRATUM_ROOTS][32];
 };
 
 struct stratum_ctx {
 	char *url;
+	/* position in the pool list, 0 for the one of -o; the user and
+	 * password are NULL when the pool takes the -u and -p ones */
+	int pooln;
+	char *user;
+	char *pass;
 
 	CURL *curl;
 	char *curl_url;
 	char curl_err_str[CURL_ERROR_SIZE];
 	curl_socket_t sock;
-	size_t sockbuf_size;
+	/* receive buffer: lines start at head, scanned for the
+	 * newline up to scan, received up to tail */
 	char *sockbuf;
+	size_t sockbuf_head;
+	size_t sockbuf_scan;
+	size_t sockbuf_tail;
 	pthread_mutex_t sock_lock;
+	/* set while the connection is run by the network loop, which
+	 * then sends what stratum_send_line() queues to sendq */
+	struct net_loop *loop;
+	struct net_queue sendq;
 
 	double next_diff;
 
@@ -470,12 +526,23 @@ struct stratum_ctx {
 	struct stratum_job job;
 	pthread_mutex_t work_lock;
 
-	struct timeval tv_submit;
+	pthread_mutex_t submit_lock;
+	int submit_id;
+	struct stratum_submit submits[STRATUM_MAX_SUBMITS];
 	uint32_t answer_msec;
 	uint32_t disconnects;
+	/* net_time_ms() of the last line received */
+	volatile uint64_t last_line;
+	/* keepalive probe waiting for its answer, id 0 if none;
+	 * under submit_lock */
+	int probe_id;
+	uint64_t probe_sent;
+	volatile bool need_reset;
 	time_t tm_connected;
 
 	int srvtime_diff;
+	/* seconds ntime may be rolled past the pool time, 0 to disable */
+	int ntime_roll;
 };
 
 struct work {
@@ -497,16 +564,35 @@ struct work {
 
 	uint32_t scanned_from;
 	uint32_t scanned_to;
+
+	/* stratum pool the job came from */
+	int pooln;
 };
 
 bool stratum_socket_full(struct stratum_ctx *sctx, int timeout);
 bool stratum_send_line(struct stratum_ctx *sctx, char *s);
+bool stratum_recv_nonblock(struct stratum_ctx *sctx);
+char *stratum_next_line(struct stratum_ctx *sctx);
 char *stratum_recv_line(struct stratum_ctx *sctx);
 bool stratum_connect(struct stratum_ctx *sctx, const char *url);
 void stratum_disconnect(struct stratum_ctx *sctx);
 bool stratum_subscribe(struct stratum_ctx *sctx);
 bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *pass,bool extranonce);
 bool stratum_handle_method(struct stratum_ctx *sctx, const char *s);
+int  stratum_submit_add(struct stratum_ctx *sctx, int thr_id, const char *job_id, uint32_t nonce);
+bool stratum_submit_take(struct stratum_ctx *sctx, int id, struct stratum_submit *sub);
+int  stratum_submit_clear(struct stratum_ctx *sctx);
+bool stratum_probe(struct stratum_ctx *sctx, uint64_t now, uint64_t idle);
+bool stratum_probe_answer(struct stratum_ctx *sctx, int id);
+bool stratum_unanswered(struct stratum_ctx *sctx, uint64_t now, uint64_t timeout);
+struct stratum_ctx *stratum_pick(struct stratum_ctx *pools, int n,
+	struct stratum_ctx *current, uint64_t now, uint64_t timeout);
+const char *pool_short_url(const struct stratum_ctx *sctx);
+struct stratum_ctx *stratum_switch(struct stratum_ctx *pools, int n,
+	struct stratum_ctx **current, uint64_t now, uint64_t timeout);
+bool stratum_loop_start(struct stratum_ctx *sctx, struct net_loop *loop);
+bool stratum_loop_step(struct stratum_ctx *sctx, struct net_loop *loop, uint64_t probe_ms,
+	bool (*on_response)(struct stratum_ctx *sctx, char *s), void (*on_line)(void));
 
 void hashlog_remember_submit(struct work* work, uint32_t nonce);
 void hashlog_remember_scan_range(struct work* work);
@@ -542,6 +628,10 @@ size_t time2str(char* buf, time_t timer);
 char* atime2str(time_t timer);
 
 void print_hash_tests(void);
+bool hash_selftest(void);
+bool hash_selftest_cpu(uint32_t seed);
+bool selftest_compare(const char *name, const uchar *hash, const char *expect);
+int bench_hashes(void);
 
 #ifdef __cplusplus
 }
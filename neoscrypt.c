@@ -34,6 +34,12 @@
 
 #include "neoscrypt.h"
 
+#ifdef _MSC_VER
+#define NEOSCRYPT_INLINE __forceinline
+#else
+#define NEOSCRYPT_INLINE inline __attribute__((always_inline))
+#endif
+
 
 /* Salsa20, rounds must be a multiple of 2 */
 static void neoscrypt_salsa(uint *X, uint rounds) {
@@ -103,6 +109,56 @@ static void neoscrypt_chacha(uint *X, uint rounds) {
 #undef quarter
 }
 
+/* Salsa20 of X and ChaCha20 of Z in lockstep, two independent
+ * dependency chains for the CPU to overlap; rounds as above */
+static void neoscrypt_salsa_chacha(uint *X, uint *Z, uint rounds) {
+    uint x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, t;
+    uint z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, u;
+
+    x0 = X[0];   x1 = X[1];   x2 = X[2];   x3 = X[3];
+    x4 = X[4];   x5 = X[5];   x6 = X[6];   x7 = X[7];
+    x8 = X[8];   x9 = X[9];  x10 = X[10]; x11 = X[11];
+   x12 = X[12]; x13 = X[13]; x14 = X[14]; x15 = X[15];
+
+    z0 = Z[0];   z1 = Z[1];   z2 = Z[2];   z3 = Z[3];
+    z4 = Z[4];   z5 = Z[5];   z6 = Z[6];   z7 = Z[7];
+    z8 = Z[8];   z9 = Z[9];  z10 = Z[10]; z11 = Z[11];
+   z12 = Z[12]; z13 = Z[13]; z14 = Z[14]; z15 = Z[15];
+
+#define quarter(a, b, c, d, e, f, g, h) \
+    t = a + d; t = ROTL32(t,  7); b ^= t; \
+    e += f; u = h ^ e; h = ROTL32(u, 16); \
+    t = b + a; t = ROTL32(t,  9); c ^= t; \
+    g += h; u = f ^ g; f = ROTL32(u, 12); \
+    t = c + b; t = ROTL32(t, 13); d ^= t; \
+    e += f; u = h ^ e; h = ROTL32(u,  8); \
+    t = d + c; t = ROTL32(t, 18); a ^= t; \
+    g += h; u = f ^ g; f = ROTL32(u,  7);
+
+    for(; rounds; rounds -= 2) {
+        quarter( x0,  x4,  x8, x12,  z0,  z4,  z8, z12);
+        quarter( x5,  x9, x13,  x1,  z1,  z5,  z9, z13);
+        quarter(x10, x14,  x2,  x6,  z2,  z6, z10, z14);
+        quarter(x15,  x3,  x7, x11,  z3,  z7, z11, z15);
+        quarter( x0,  x1,  x2,  x3,  z0,  z5, z10, z15);
+        quarter( x5,  x6,  x7,  x4,  z1,  z6, z11, z12);
+        quarter(x10, x11,  x8,  x9,  z2,  z7,  z8, z13);
+        quarter(x15, x12, x13, x14,  z3,  z4,  z9, z14);
+    }
+
+    X[0] += x0;   X[1] += x1;   X[2] += x2;   X[3] += x3;
+    X[4] += x4;   X[5] += x5;   X[6] += x6;   X[7] += x7;
+    X[8] += x8;   X[9] += x9;  X[10] += x10; X[11] += x11;
+   X[12] += x12; X[13] += x13; X[14] += x14; X[15] += x15;
+
+    Z[0] += z0;   Z[1] += z1;   Z[2] += z2;   Z[3] += z3;
+    Z[4] += z4;   Z[5] += z5;   Z[6] += z6;   Z[7] += z7;
+    Z[8] += z8;   Z[9] += z9;  Z[10] += z10; Z[11] += z11;
+   Z[12] += z12; Z[13] += z13; Z[14] += z14; Z[15] += z15;
+
+#undef quarter
+}
+
 /* Fast 32-bit / 64-bit memcpy();
  * len must be a multiple of 32 bytes */
 static void neoscrypt_blkcpy(void *dstp, const void *srcp, uint len) {
@@ -1727,44 +1783,14 @@ static const uint blake2s_IV_P_XOR[8] = {
     0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
 };
 
-/* Performance optimised FastKDF with BLAKE2s integrated */
-void neoscrypt_fastkdf_opt(const uchar *password, const uchar *salt,
-  uchar *output, uint mode) {
-    const size_t stack_align = 0x40;
-    uint bufptr, output_len, i, j;
-    uchar *A, *B;
-    uint *S;
-
-    /* Align and set up the buffers in stack */
-#ifdef _MSC_VER
-    uchar *stack = (uchar *) malloc(864 + stack_align);
-#else
-    uchar stack[864 + stack_align];
-#endif
-    A = (uchar *) (((size_t)stack & ~(stack_align - 1)) + stack_align);
-    B = &A[320];
-    S = (uint *) &A[608];
-
-    neoscrypt_copy(&A[0],   &password[0], 80);
-    neoscrypt_copy(&A[80],  &password[0], 80);
-    neoscrypt_copy(&A[160], &password[0], 80);
-    neoscrypt_copy(&A[240], &password[0], 16);
-    neoscrypt_copy(&A[256], &password[0], 64);
-
-    if(!mode) {
-        output_len = 256;
-        neoscrypt_copy(&B[0],   &salt[0], 80);
-        neoscrypt_copy(&B[80],  &salt[0], 80);
-        neoscrypt_copy(&B[160], &salt[0], 80);
-        neoscrypt_copy(&B[240], &salt[0], 16);
-        neoscrypt_copy(&B[256], &salt[0], 32);
-    } else {
-        output_len = 32;
-        neoscrypt_copy(&B[0],   &salt[0], 256);
-        neoscrypt_copy(&B[256], &salt[0], 32);
-    }
+/* FastKDF rounds first to last - 1 over buffers prepared by the caller:
+ * A is the 320-byte password buffer, B is the 288-byte salt buffer
+ * and S is a 256-byte BLAKE2s state; returns the new bufptr */
+static uint neoscrypt_fastkdf_rounds(const uchar *A, uchar *B, uint *S,
+  uint bufptr, uint first, uint last) {
+    uint i, j;
 
-    for(i = 0, bufptr = 0; i < 32; i++) {
+    for(i = first; i < last; i++) {
 
         /* BLAKE2s: initialise */
         neoscrypt_copy(&S[0], blake2s_IV_P_XOR, 32);
@@ -1803,6 +1829,14 @@ void neoscrypt_fastkdf_opt(const uchar *password, const uchar *salt,
 
     }
 
+    return(bufptr);
+}
+
+/* FastKDF output: B[bufptr] XOR A with wrap-around of B */
+static void neoscrypt_fastkdf_out(const uchar *A, uchar *B, uint bufptr,
+  uchar *output, uint output_len) {
+    uint i;
+
     i = 256 - bufptr;
     if(i >= output_len) {
         neoscrypt_xor(&B[bufptr], &A[0], output_len);
@@ -1813,6 +1847,89 @@ void neoscrypt_fastkdf_opt(const uchar *password, const uchar *salt,
         neoscrypt_copy(&output[0], &B[bufptr], i);
         neoscrypt_copy(&output[i], &B[0], output_len - i);
     }
+}
+
+/* FastKDF output words from the most significant down while they
+ * equal the target; 1 if the output is at or below the target */
+static int neoscrypt_fastkdf_check(const uchar *A, const uchar *B,
+  uint bufptr, const uint *target) {
+    uchar w[4];
+    uint i, k, v;
+
+    for(i = 8; i--; ) {
+        for(k = 0; k < 4; k++)
+          w[k] = B[(bufptr + i * 4 + k) & 0xFF] ^ A[i * 4 + k];
+        neoscrypt_copy(&v, w, 4);
+        if(v != target[i])
+          return(v < target[i]);
+    }
+
+    return(1);
+}
+
+/* FastKDF up to the output in 864 bytes of aligned scratch;
+ * 80-byte password, salt of 80 bytes or a divisor of 256;
+ * returns bufptr, A and B are left at the start of scratch */
+static uint neoscrypt_fastkdf_run(const uchar *password, const uchar *salt,
+  uint salt_len, uchar *scratch) {
+    uint i;
+    uchar *A, *B;
+    uint *S;
+
+    A = scratch;
+    B = &A[320];
+    S = (uint *) &A[608];
+
+    neoscrypt_copy(&A[0],   &password[0], 80);
+    neoscrypt_copy(&A[80],  &password[0], 80);
+    neoscrypt_copy(&A[160], &password[0], 80);
+    neoscrypt_copy(&A[240], &password[0], 16);
+    neoscrypt_copy(&A[256], &password[0], 64);
+
+    if(salt_len == 80) {
+        neoscrypt_copy(&B[0],   &salt[0], 80);
+        neoscrypt_copy(&B[80],  &salt[0], 80);
+        neoscrypt_copy(&B[160], &salt[0], 80);
+        neoscrypt_copy(&B[240], &salt[0], 16);
+        neoscrypt_copy(&B[256], &salt[0], 32);
+    } else {
+        for(i = 0; i < 256; i += salt_len)
+          neoscrypt_copy(&B[i], &salt[0], salt_len);
+        neoscrypt_copy(&B[256], &B[0], 32);
+    }
+
+    return(neoscrypt_fastkdf_rounds(A, B, S, 0, 0, 32));
+}
+
+/* FastKDF with BLAKE2s integrated in 864 bytes of aligned scratch;
+ * up to 256 bytes of output */
+static void neoscrypt_fastkdf_scratch(const uchar *password, const uchar *salt,
+  uint salt_len, uchar *output, uint output_len, uchar *scratch) {
+    uint bufptr;
+
+    bufptr = neoscrypt_fastkdf_run(password, salt, salt_len, scratch);
+
+    neoscrypt_fastkdf_out(scratch, &scratch[320], bufptr, output, output_len);
+}
+
+/* Performance optimised FastKDF with BLAKE2s integrated */
+void neoscrypt_fastkdf_opt(const uchar *password, const uchar *salt,
+  uchar *output, uint mode) {
+    const size_t stack_align = 0x40;
+
+    /* Align and set up the buffers in stack */
+#ifdef _MSC_VER
+    uchar *stack = (uchar *) malloc(864 + stack_align);
+#else
+    uchar stack[864 + stack_align];
+#endif
+
+    if(!mode)
+      neoscrypt_fastkdf_scratch(password, salt, 80, output, 256,
+        (uchar *) (((size_t)stack & ~(stack_align - 1)) + stack_align));
+    else
+      neoscrypt_fastkdf_scratch(password, salt, 256, output, 32,
+        (uchar *) (((size_t)stack & ~(stack_align - 1)) + stack_align));
 
 #ifdef _MSC_VER
     free(stack);
@@ -1820,8 +1937,340 @@ void neoscrypt_fastkdf_opt(const uchar *password, const uchar *salt,
 }
 
 
+/* SHA-256 and BLAKE-256 for the PBKDF2 based profiles */
+
+/* State of either hash; T is the 64-bit message bit counter */
+typedef struct neoscrypt_hash_state_t {
+    uint  H[8];
+    uint  T[2];
+    uint  leftover;
+    uint  blake;
+    uchar buffer[BLOCK_SIZE];
+} neoscrypt_hash_state;
+
+static const uint sha256_constants[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+/* Both hashes start from the SHA-256 initial values */
+static const uint sha256_IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+#define Ch(x, y, z)  (z ^ (x & (y ^ z)))
+#define Maj(x, y, z) (((x | y) & z) | (x & y))
+#define S0(x)        (ROTR32(x,  2) ^ ROTR32(x, 13) ^ ROTR32(x, 22))
+#define S1(x)        (ROTR32(x,  6) ^ ROTR32(x, 11) ^ ROTR32(x, 25))
+#define G0(x)        (ROTR32(x,  7) ^ ROTR32(x, 18) ^ (x >>  3))
+#define G1(x)        (ROTR32(x, 17) ^ ROTR32(x, 19) ^ (x >> 10))
+
+static void sha256_blocks(neoscrypt_hash_state *S, const uchar *in, uint blocks) {
+    uint r[8], w[64], t0, t1;
+    uint i;
+
+    for(i = 0; i < 8; i++)
+      r[i] = S->H[i];
+
+    while(blocks--) {
+        for(i = 0; i < 16; i++)
+          w[i] = U8TO32_BE(&in[i * 4]);
+        for(i = 16; i < 64; i++)
+          w[i] = G1(w[i - 2]) + w[i - 7] + G0(w[i - 15]) + w[i - 16];
+
+        for(i = 0; i < 64; i++) {
+            t1 = S0(r[0]) + Maj(r[0], r[1], r[2]);
+            t0 = r[7] + S1(r[4]) + Ch(r[4], r[5], r[6]) + sha256_constants[i] + w[i];
+            r[7] = r[6];
+            r[6] = r[5];
+            r[5] = r[4];
+            r[4] = r[3] + t0;
+            r[3] = r[2];
+            r[2] = r[1];
+            r[1] = r[0];
+            r[0] = t0 + t1;
+        }
+
+        for(i = 0; i < 8; i++) {
+            r[i] += S->H[i];
+            S->H[i] = r[i];
+        }
+
+        S->T[0] += BLOCK_SIZE * 8;
+        S->T[1] += (S->T[0] < BLOCK_SIZE * 8);
+        in += BLOCK_SIZE;
+    }
+}
+
+#undef Ch
+#undef Maj
+#undef S0
+#undef S1
+#undef G0
+#undef G1
+
+static const uchar blake256_sigma[10][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 }
+};
+
+static const uint blake256_constants[16] = {
+    0x243F6A88, 0x85A308D3, 0x13198A2E, 0x03707344,
+    0xA4093822, 0x299F31D0, 0x082EFA98, 0xEC4E6C89,
+    0x452821E6, 0x38D01377, 0xBE5466CF, 0x34E90C6C,
+    0xC0AC29B7, 0xC97C50DD, 0x3F84D5B5, 0xB5470917
+};
+
+/* BLAKE-256 with 14 rounds; the counter is incremented before
+ * every block which allows the final one to cover no message bits */
+static void blake256_blocks(neoscrypt_hash_state *S, const uchar *in, uint blocks) {
+    const uchar *sigma;
+    uint m[16], v[16];
+    uint i;
+
+    while(blocks--) {
+        S->T[0] += BLOCK_SIZE * 8;
+        S->T[1] += (S->T[0] < BLOCK_SIZE * 8);
+
+        for(i = 0; i < 8; i++)
+          v[i] = S->H[i];
+        for(i = 0; i < 4; i++)
+          v[i + 8] = blake256_constants[i];
+        v[12] = blake256_constants[4] ^ S->T[0];
+        v[13] = blake256_constants[5] ^ S->T[0];
+        v[14] = blake256_constants[6] ^ S->T[1];
+        v[15] = blake256_constants[7] ^ S->T[1];
+
+        for(i = 0; i < 16; i++)
+          m[i] = U8TO32_BE(&in[i * 4]);
+
+#define G(a, b, c, d, e) \
+    v[a] += (m[sigma[e]] ^ blake256_constants[sigma[e + 1]]) + v[b]; \
+    v[d] = ROTR32(v[d] ^ v[a], 16); \
+    v[c] += v[d]; \
+    v[b] = ROTR32(v[b] ^ v[c], 12); \
+    v[a] += (m[sigma[e + 1]] ^ blake256_constants[sigma[e]]) + v[b]; \
+    v[d] = ROTR32(v[d] ^ v[a], 8); \
+    v[c] += v[d]; \
+    v[b] = ROTR32(v[b] ^ v[c], 7);
+
+        for(i = 0; i < 14; i++) {
+            sigma = blake256_sigma[i % 10];
+            G(0, 4,  8, 12,  0);
+            G(1, 5,  9, 13,  2);
+            G(2, 6, 10, 14,  4);
+            G(3, 7, 11, 15,  6);
+            G(0, 5, 10, 15,  8);
+            G(1, 6, 11, 12, 10);
+            G(2, 7,  8, 13, 12);
+            G(3, 4,  9, 14, 14);
+        }
+
+#undef G
+
+        for(i = 0; i < 8; i++)
+          S->H[i] ^= v[i] ^ v[i + 8];
+
+        in += BLOCK_SIZE;
+    }
+}
+
+static void neoscrypt_hash_blocks(neoscrypt_hash_state *S, const uchar *in,
+  uint blocks) {
+
+    if(S->blake)
+      blake256_blocks(S, in, blocks);
+    else
+      sha256_blocks(S, in, blocks);
+}
+
+static void neoscrypt_hash_init(neoscrypt_hash_state *S, uint blake) {
+
+    neoscrypt_copy(S->H, sha256_IV, 32);
+    S->T[0] = 0;
+    S->T[1] = 0;
+    S->leftover = 0;
+    S->blake = blake;
+}
+
+static void neoscrypt_hash_update(neoscrypt_hash_state *S, const uchar *in,
+  uint inlen) {
+    uint blocks, want;
+
+    /* Previous data */
+    if(S->leftover) {
+        want = MIN(BLOCK_SIZE - S->leftover, inlen);
+        neoscrypt_copy(S->buffer + S->leftover, in, want);
+        S->leftover += want;
+        if(S->leftover < BLOCK_SIZE)
+          return;
+        in += want;
+        inlen -= want;
+        neoscrypt_hash_blocks(S, S->buffer, 1);
+    }
+
+    /* Current data */
+    blocks = inlen & ~(BLOCK_SIZE - 1);
+    S->leftover = inlen - blocks;
+    if(blocks) {
+        neoscrypt_hash_blocks(S, in, blocks / BLOCK_SIZE);
+        in += blocks;
+    }
+
+    /* Data left over */
+    if(S->leftover)
+      neoscrypt_copy(S->buffer, in, S->leftover);
+}
+
+/* Sets the counter so that the next block is hashed with th:tl bits;
+ * only BLAKE-256 makes use of it */
+static void neoscrypt_hash_counter(neoscrypt_hash_state *S, uint tl, uint th) {
+
+    S->T[0] = tl - BLOCK_SIZE * 8;
+    S->T[1] = th - (tl < BLOCK_SIZE * 8);
+}
+
+static void neoscrypt_hash_finish(neoscrypt_hash_state *S, uchar *hash) {
+    uint tl, th, i;
+
+    /* Message length in bits */
+    tl = S->T[0] + (S->leftover << 3);
+    th = S->T[1] + (tl < (S->leftover << 3));
+
+    S->buffer[S->leftover] = 0x80;
+    if(S->leftover <= 55) {
+        neoscrypt_erase(S->buffer + S->leftover + 1, 55 - S->leftover);
+        /* A block without message bits has a zero counter */
+        if(S->leftover)
+          neoscrypt_hash_counter(S, tl, th);
+        else
+          neoscrypt_hash_counter(S, 0, 0);
+    } else {
+        neoscrypt_erase(S->buffer + S->leftover + 1, 63 - S->leftover);
+        neoscrypt_hash_counter(S, tl, th);
+        neoscrypt_hash_blocks(S, S->buffer, 1);
+        neoscrypt_erase(S->buffer, 56);
+        neoscrypt_hash_counter(S, 0, 0);
+    }
+
+    if(S->blake)
+      S->buffer[55] |= 1;
+
+    U32TO8_BE(S->buffer + 56, th);
+    U32TO8_BE(S->buffer + 60, tl);
+    neoscrypt_hash_blocks(S, S->buffer, 1);
+
+    for(i = 0; i < 8; i++) {
+        U32TO8_BE(&hash[i * 4], S->H[i]);
+    }
+}
+
+/* HMAC of either hash */
+typedef struct neoscrypt_hmac_state_t {
+    neoscrypt_hash_state inner, outer;
+} neoscrypt_hmac_state;
+
+static void neoscrypt_hmac_init(neoscrypt_hmac_state *st, uint blake,
+  const uchar *key, uint keylen) {
+    neoscrypt_hash_state K;
+    uchar pad[BLOCK_SIZE];
+    uint i;
+
+    neoscrypt_hash_init(&st->inner, blake);
+    neoscrypt_hash_init(&st->outer, blake);
+
+    neoscrypt_erase(pad, BLOCK_SIZE);
+    if(keylen <= BLOCK_SIZE) {
+        neoscrypt_copy(pad, key, keylen);
+    } else {
+        /* Long keys are hashed */
+        neoscrypt_hash_init(&K, blake);
+        neoscrypt_hash_update(&K, key, keylen);
+        neoscrypt_hash_finish(&K, pad);
+    }
+
+    /* inner = H((key ^ 0x36) || ...) */
+    for(i = 0; i < BLOCK_SIZE; i++)
+      pad[i] ^= 0x36;
+    neoscrypt_hash_update(&st->inner, pad, BLOCK_SIZE);
+
+    /* outer = H((key ^ 0x5C) || ...) */
+    for(i = 0; i < BLOCK_SIZE; i++)
+      pad[i] ^= (0x5C ^ 0x36);
+    neoscrypt_hash_update(&st->outer, pad, BLOCK_SIZE);
+}
+
+static void neoscrypt_hmac_update(neoscrypt_hmac_state *st, const uchar *m,
+  uint mlen) {
+
+    neoscrypt_hash_update(&st->inner, m, mlen);
+}
+
+static void neoscrypt_hmac_finish(neoscrypt_hmac_state *st, uchar *mac) {
+    uchar innerhash[DIGEST_SIZE];
+
+    neoscrypt_hash_finish(&st->inner, innerhash);
+    neoscrypt_hash_update(&st->outer, innerhash, DIGEST_SIZE);
+    neoscrypt_hash_finish(&st->outer, mac);
+}
+
+/* PBKDF2 with HMAC-SHA256 or HMAC-BLAKE256 and c iterations */
+static void neoscrypt_pbkdf2(uint blake, const uchar *password, uint password_len,
+  const uchar *salt, uint salt_len, uint c, uchar *output, uint output_len) {
+    neoscrypt_hmac_state hmac_pw, hmac_pw_salt, work;
+    uchar ti[DIGEST_SIZE], u[DIGEST_SIZE], be[4];
+    uint i, j, k, blocks;
+
+    /* hmac(password, ...) */
+    neoscrypt_hmac_init(&hmac_pw, blake, password, password_len);
+
+    /* hmac(password, salt || ...) */
+    hmac_pw_salt = hmac_pw;
+    neoscrypt_hmac_update(&hmac_pw_salt, salt, salt_len);
+
+    blocks = (output_len + DIGEST_SIZE - 1) / DIGEST_SIZE;
+    for(i = 1; i <= blocks; i++) {
+        /* U1 = hmac(password, salt || be(i)) */
+        U32TO8_BE(be, i);
+        work = hmac_pw_salt;
+        neoscrypt_hmac_update(&work, be, 4);
+        neoscrypt_hmac_finish(&work, ti);
+        neoscrypt_copy(u, ti, DIGEST_SIZE);
+
+        /* T[i] = U1 ^ U2 ^ U3 ... */
+        for(j = 1; j < c; j++) {
+            work = hmac_pw;
+            neoscrypt_hmac_update(&work, u, DIGEST_SIZE);
+            neoscrypt_hmac_finish(&work, u);
+            for(k = 0; k < DIGEST_SIZE; k++)
+              ti[k] ^= u[k];
+        }
+
+        neoscrypt_copy(output, ti, MIN(output_len, DIGEST_SIZE));
+        output += DIGEST_SIZE;
+        output_len -= MIN(output_len, DIGEST_SIZE);
+    }
+}
+
+
 /* Configurable optimised block mixer */
-static void neoscrypt_blkmix(uint *X, uint *Y, uint r, uint mixmode) {
+static NEOSCRYPT_INLINE void neoscrypt_blkmix(uint *X, uint *Y, uint r,
+  uint mixmode) {
     uint i, mixer, rounds;
 
     mixer  = mixmode >> 8;
@@ -1892,50 +2341,13 @@ static void neoscrypt_blkmix(uint *X, uint *Y, uint r, uint mixmode) {
 }
 
 
-/* NeoScrypt core engine:
- * p = 1, salt = password;
- * Basic customisation (required):
- *   profile bit 0:
- *     0 = NeoScrypt(128, 2, 1) with Salsa20/20 and ChaCha20/20;
- *     1 = Scrypt(1024, 1, 1) with Salsa20/8;
- *   profile bits 4 to 1:
- *     0000 = FastKDF-BLAKE2s;
- *     0001 = PBKDF2-HMAC-SHA256;
- *     0010 = PBKDF2-HMAC-BLAKE256;
- * Extended customisation (optional):
- *   profile bit 31:
- *     0 = extended customisation absent;
- *     1 = extended customisation present;
- *   profile bits 7 to 5 (rfactor):
- *     000 = r of 1;
- *     001 = r of 2;
- *     010 = r of 4;
- *     ...
- *     111 = r of 128;
- *   profile bits 12 to 8 (Nfactor):
- *     00000 = N of 2;
- *     00001 = N of 4;
- *     00010 = N of 8;
- *     .....
- *     00110 = N of 128;
- *     .....
- *     01001 = N of 1024;
- *     .....
- *     11110 = N of 2147483648;
- *   profile bits 30 to 13 are reserved */
-void neoscrypt(const uchar *password, uchar *output) {
-    const size_t stack_align = 0x40;
-    uint N = 128, r = 2, dblmix = 1, mixmode = 0x14;
-    uint i, j;
-    uint *X, *Y, *Z, *V;
-    
-#ifdef _MSC_VER
-    uchar *stack = (uchar *) malloc((N + 3) * r * 2 * BLOCK_SIZE + stack_align);
-#else
-    uchar stack[(N + 3) * r * 2 * BLOCK_SIZE + stack_align];
-#endif
-    /* X = r * 2 * BLOCK_SIZE */
-    X = (uint *) (((size_t)stack & ~(stack_align - 1)) + stack_align);
+/* Double SMix of X in place, ChaCha 1st and Salsa 2nd if dblmix;
+ * Z, Y and V follow X as laid out by neoscrypt() */
+static NEOSCRYPT_INLINE void neoscrypt_mix(uint *X, uint N, uint r,
+  uint dblmix, uint mixmode) {
+    size_t i, j;
+    uint *Y, *Z, *V;
+
     /* Z is a copy of X for ChaCha */
     Z = &X[32 * r];
     /* Y is an X sized temporal space */
@@ -1943,9 +2355,6 @@ void neoscrypt(const uchar *password, uchar *output) {
     /* V = N * r * 2 * BLOCK_SIZE */
     V = &X[96 * r];
 
-    /* X = KDF(password, salt) */
-    neoscrypt_fastkdf_opt(password, password, (uchar *) X, 0);
-
     /* Process ChaCha 1st, Salsa 2nd and XOR them into FastKDF; otherwise Salsa only */
 
     if(dblmix) {
@@ -1962,7 +2371,7 @@ void neoscrypt(const uchar *password, uchar *output) {
 
         for(i = 0; i < N; i++) {
             /* integerify(Z) mod N */
-            j = (32 * r) * (Z[16 * (2 * r - 1)] & (N - 1));
+            j = (size_t)(32 * r) * (Z[16 * (2 * r - 1)] & (N - 1));
             /* blkxor(Z, V) */
             neoscrypt_blkxor(&Z[0], &V[j], r * 2 * BLOCK_SIZE);
             /* blkmix(Z, Y) */
@@ -1979,7 +2388,7 @@ void neoscrypt(const uchar *password, uchar *output) {
     }
     for(i = 0; i < N; i++) {
         /* integerify(X) mod N */
-        j = (32 * r) * (X[16 * (2 * r - 1)] & (N - 1));
+        j = (size_t)(32 * r) * (X[16 * (2 * r - 1)] & (N - 1));
         /* blkxor(X, V) */
         neoscrypt_blkxor(&X[0], &V[j], r * 2 * BLOCK_SIZE);
         /* blkmix(X, Y) */
@@ -1989,11 +2398,445 @@ void neoscrypt(const uchar *password, uchar *output) {
     if(dblmix)
       /* blkxor(X, Z) */
       neoscrypt_blkxor(&X[0], &Z[0], r * 2 * BLOCK_SIZE);
+}
+
+/* NeoScrypt block mixer for r = 2 on X with Salsa20/20
+ * and Z with ChaCha20/20 in lockstep */
+static NEOSCRYPT_INLINE void neoscrypt_blkmix_dbl(uint *X, uint *Z) {
+
+    neoscrypt_blkxor(&X[0], &X[48], BLOCK_SIZE);
+    neoscrypt_blkxor(&Z[0], &Z[48], BLOCK_SIZE);
+    neoscrypt_salsa_chacha(&X[0], &Z[0], 20);
+    neoscrypt_blkxor(&X[16], &X[0], BLOCK_SIZE);
+    neoscrypt_blkxor(&Z[16], &Z[0], BLOCK_SIZE);
+    neoscrypt_salsa_chacha(&X[16], &Z[16], 20);
+    neoscrypt_blkxor(&X[32], &X[16], BLOCK_SIZE);
+    neoscrypt_blkxor(&Z[32], &Z[16], BLOCK_SIZE);
+    neoscrypt_salsa_chacha(&X[32], &Z[32], 20);
+    neoscrypt_blkxor(&X[48], &X[32], BLOCK_SIZE);
+    neoscrypt_blkxor(&Z[48], &Z[32], BLOCK_SIZE);
+    neoscrypt_salsa_chacha(&X[48], &Z[48], 20);
+    neoscrypt_blkswp(&X[16], &X[32], BLOCK_SIZE);
+    neoscrypt_blkswp(&Z[16], &Z[32], BLOCK_SIZE);
+}
+
+/* SMix specialised for the common profiles; constant N, r and mixmode
+ * let the compiler fold the inlined neoscrypt_mix() and blkmix() */
+
+/* NeoScrypt(128, 2, 1) with Salsa20/20 and ChaCha20/20;
+ * the ChaCha and Salsa SMix run in lockstep rather than one after
+ * another, so Z has its own V right after the V of X */
+static void neoscrypt_mix_neoscrypt(uint *X) {
+    size_t i, jx, jz;
+    uint *Z, *VX, *VZ;
+
+    Z  = &X[64];
+    VX = &X[192];
+    VZ = &VX[128 * 64];
+
+    /* blkcpy(Z, X) */
+    neoscrypt_blkcpy(&Z[0], &X[0], 256);
+
+    for(i = 0; i < 128; i++) {
+        /* blkcpy(V, X) and blkcpy(V, Z) */
+        neoscrypt_blkcpy(&VX[i * 64], &X[0], 256);
+        neoscrypt_blkcpy(&VZ[i * 64], &Z[0], 256);
+        neoscrypt_blkmix_dbl(&X[0], &Z[0]);
+    }
+
+    for(i = 0; i < 128; i++) {
+        /* integerify(X) mod N and integerify(Z) mod N */
+        jx = (size_t)64 * (X[48] & 127);
+        jz = (size_t)64 * (Z[48] & 127);
+        /* blkxor(X, V) and blkxor(Z, V) */
+        neoscrypt_blkxor(&X[0], &VX[jx], 256);
+        neoscrypt_blkxor(&Z[0], &VZ[jz], 256);
+        neoscrypt_blkmix_dbl(&X[0], &Z[0]);
+    }
+
+    /* blkxor(X, Z) */
+    neoscrypt_blkxor(&X[0], &Z[0], 256);
+}
+
+/* NeoScrypt(128, 2, 1) with one V shared by the ChaCha and the Salsa
+ * SMix, which run one after another; half the scratch of the lockstep
+ * mixer for the callers that hash on the stack */
+static void neoscrypt_mix_neoscrypt_1v(uint *X) {
+    neoscrypt_mix(X, 128, 2, 1, 0x14);
+}
+
+/* Scrypt(1024, 1, 1) with Salsa20/8 */
+static void neoscrypt_mix_scrypt(uint *X) {
+    neoscrypt_mix(X, 1024, 1, 0, 0x08);
+}
+
+/* Scratch of the single V NeoScrypt wrappers on the stack below:
+ * X, Z, Y, one V and the FastKDF buffers */
+#define NEOSCRYPT_STACK_SIZE ((128 + 3) * 256 + 864)
+
+/* neoscrypt_core() with vtabs V tables, 1 or 2, in scratch */
+static void neoscrypt_core_vtabs(const uchar *password, uchar *output,
+  uchar *scratch, uint vtabs) {
+    uint N = 128, r = 2;
+    uint *X;
+    uchar *K;
+
+    /* X = r * 2 * BLOCK_SIZE */
+    X = (uint *) scratch;
+    /* FastKDF buffers follow the V */
+    K = (uchar *) &X[(vtabs * N + 3) * 32 * r];
+
+    /* X = KDF(password, salt) */
+    neoscrypt_fastkdf_scratch(password, password, 80, (uchar *) X, 256, K);
+
+    if(vtabs == 2)
+      neoscrypt_mix_neoscrypt(X);
+    else
+      neoscrypt_mix_neoscrypt_1v(X);
+
+    /* output = KDF(password, X) */
+    neoscrypt_fastkdf_scratch(password, (uchar *) X, 256, output, 32, K);
+}
+
+
+/* NeoScrypt core engine, profile 0 of neoscrypt_profile() below */
+void neoscrypt(const uchar *password, uchar *output) {
+    const size_t stack_align = 0x40;
+
+#ifdef _MSC_VER
+    uchar *stack = (uchar *) malloc(NEOSCRYPT_STACK_SIZE + stack_align);
+#else
+    uchar stack[NEOSCRYPT_STACK_SIZE + stack_align];
+#endif
+
+    neoscrypt_core_vtabs(password, output,
+      (uchar *) (((size_t)stack & ~(stack_align - 1)) + stack_align), 1);
+
+#ifdef _MSC_VER
+    free(stack);
+#endif
+}
+
+/* neoscrypt() in caller supplied scratch, 64-byte aligned
+ * and NEOSCRYPT_SCRATCH_SIZE bytes long */
+void neoscrypt_core(const uchar *password, uchar *output, uchar *scratch) {
+    neoscrypt_core_vtabs(password, output, scratch, 2);
+}
+
+
+/* Share check: 1 if NeoScrypt of password is at or below target,
+ * both 8 words with the most significant last as in fulltest();
+ * the closing FastKDF derives only the words the comparison needs */
+int neoscrypt_check(const uchar *password, const uint *target) {
+    const size_t stack_align = 0x40;
+    uint N = 128, r = 2, bufptr;
+    uint *X;
+    uchar *K;
+    int ret;
+
+#ifdef _MSC_VER
+    uchar *stack = (uchar *) malloc(NEOSCRYPT_STACK_SIZE + stack_align);
+#else
+    uchar stack[NEOSCRYPT_STACK_SIZE + stack_align];
+#endif
+    X = (uint *) (((size_t)stack & ~(stack_align - 1)) + stack_align);
+    K = (uchar *) &X[(N + 3) * 32 * r];
+
+    /* X = KDF(password, salt) */
+    neoscrypt_fastkdf_scratch(password, password, 80, (uchar *) X, 256, K);
+
+    neoscrypt_mix_neoscrypt_1v(X);
+
+    /* output = KDF(password, X) compared against target */
+    bufptr = neoscrypt_fastkdf_run(password, (uchar *) X, 256, K);
+    ret = neoscrypt_fastkdf_check(K, &K[320], bufptr, target);
+
+#ifdef _MSC_VER
+    free(stack);
+#endif
+
+    return(ret);
+}
+
+
+/* NeoScrypt core engine:
+ * p = 1, salt = password;
+ * Basic customisation (required):
+ *   profile bit 0:
+ *     0 = NeoScrypt(128, 2, 1) with Salsa20/20 and ChaCha20/20;
+ *     1 = Scrypt(1024, 1, 1) with Salsa20/8;
+ *   profile bits 4 to 1:
+ *     0000 = FastKDF-BLAKE2s;
+ *     0001 = PBKDF2-HMAC-SHA256;
+ *     0010 = PBKDF2-HMAC-BLAKE256;
+ * Extended customisation (optional):
+ *   profile bit 31:
+ *     0 = extended customisation absent;
+ *     1 = extended customisation present;
+ *   profile bits 7 to 5 (rfactor):
+ *     000 = r of 1;
+ *     001 = r of 2;
+ *     010 = r of 4;
+ *     ...
+ *     111 = r of 128;
+ *   profile bits 12 to 8 (Nfactor):
+ *     00000 = N of 2;
+ *     00001 = N of 4;
+ *     00010 = N of 8;
+ *     .....
+ *     00110 = N of 128;
+ *     .....
+ *     01001 = N of 1024;
+ *     .....
+ *     11110 = N of 2147483648;
+ *   profile bits 30 to 13 are reserved;
+ * FastKDF produces up to 256 bytes, so r over 2 needs a PBKDF2 profile;
+ * returns 0 on success, -1 on an unsupported profile or no memory */
+int neoscrypt_profile(const uchar *password, uchar *output, uint profile) {
+    const size_t stack_align = 0x40;
+    uint N = 128, r = 2, dblmix = 1, mixmode = 0x14, kdf, vtabs;
+    size_t size;
+    uchar *stack, *K;
+    uint *X;
+
+    /* Standard Scrypt setup */
+    if(profile & 0x1) {
+        N = 1024;
+        r = 1;
+        dblmix = 0;
+        /* Salsa20/8 */
+        mixmode = 0x08;
+    }
+
+    /* Extended customisation */
+    if(profile >> 31) {
+        if(((profile >> 8) & 0x1F) == 0x1F)
+          return(-1);
+        N = 1U << (((profile >> 8) & 0x1F) + 1);
+        r = 1U << ((profile >> 5) & 0x7);
+    }
+
+    kdf = (profile >> 1) & 0xF;
+    if((kdf > 0x2) || (!kdf && (r > 2)))
+      return(-1);
+
+    /* The common case keeps its own fully unrolled path */
+    if(!kdf && dblmix && (N == 128) && (r == 2)) {
+        neoscrypt(password, output);
+        return(0);
+    }
+
+    /* X, Z, Y, V and the FastKDF buffers;
+     * the NeoScrypt(128, 2, 1) mixer keeps a 2nd V for Z */
+    vtabs = (dblmix && (N == 128) && (r == 2) && (mixmode == 0x14)) ? 2 : 1;
+    if(((size_t)N * vtabs + 3) > (((size_t)-1) - 864 - stack_align) / (r * 2 * BLOCK_SIZE))
+      return(-1);
+    size = ((size_t)N * vtabs + 3) * r * 2 * BLOCK_SIZE;
+    stack = (uchar *) malloc(size + 864 + stack_align);
+    if(!stack)
+      return(-1);
+    X = (uint *) (((size_t)stack & ~(stack_align - 1)) + stack_align);
+    K = &((uchar *) X)[size];
+
+    /* X = KDF(password, salt) */
+    switch(kdf) {
+
+        default:
+        case(0x0):
+            neoscrypt_fastkdf_scratch(password, password, 80,
+              (uchar *) X, r * 2 * BLOCK_SIZE, K);
+            break;
+
+        case(0x1):
+            neoscrypt_pbkdf2(0, password, 80, password, 80, 1,
+              (uchar *) X, r * 2 * BLOCK_SIZE);
+            break;
+
+        case(0x2):
+            neoscrypt_pbkdf2(1, password, 80, password, 80, 1,
+              (uchar *) X, r * 2 * BLOCK_SIZE);
+            break;
+
+    }
+
+    if(vtabs == 2)
+      neoscrypt_mix_neoscrypt(X);
+    else if(!dblmix && (N == 1024) && (r == 1) && (mixmode == 0x08))
+      neoscrypt_mix_scrypt(X);
+    else
+      neoscrypt_mix(X, N, r, dblmix, mixmode);
 
     /* output = KDF(password, X) */
-    neoscrypt_fastkdf_opt(password, (uchar *) X, output, 1);
+    switch(kdf) {
+
+        default:
+        case(0x0):
+            neoscrypt_fastkdf_scratch(password, (uchar *) X,
+              r * 2 * BLOCK_SIZE, output, 32, K);
+            break;
+
+        case(0x1):
+            neoscrypt_pbkdf2(0, password, 80, (uchar *) X, r * 2 * BLOCK_SIZE, 1,
+              output, 32);
+            break;
+
+        case(0x2):
+            neoscrypt_pbkdf2(1, password, 80, (uchar *) X, r * 2 * BLOCK_SIZE, 1,
+              output, 32);
+            break;
+
+    }
+
+    free(stack);
+
+    return(0);
+}
+
+
+/* Runs an internal primitive iterations times for benchmarking;
+ * state is 256 bytes owned by the caller and is updated in place,
+ * so every call depends on the previous one */
+void neoscrypt_bench(uint primitive, uint iterations, uint *state) {
+    uint i;
+
+    switch(primitive) {
+
+        case(NEOSCRYPT_BENCH_SALSA):
+            for(i = 0; i < iterations; i++)
+              neoscrypt_salsa(state, 20);
+            break;
+
+        case(NEOSCRYPT_BENCH_CHACHA):
+            for(i = 0; i < iterations; i++)
+              neoscrypt_chacha(state, 20);
+            break;
+
+        case(NEOSCRYPT_BENCH_BLAKE2S):
+            for(i = 0; i < iterations; i++)
+              blake2s_compress((blake2s_state *) state);
+            break;
+
+        case(NEOSCRYPT_BENCH_FASTKDF):
+            /* 80 bytes in, 256 bytes out */
+            for(i = 0; i < iterations; i++)
+              neoscrypt_fastkdf_opt((uchar *) state, (uchar *) state,
+                (uchar *) state, 0);
+            break;
+
+    }
+}
+
+
+/* Byte offsets of the nonce copies in the FastKDF buffers */
+static const uint neoscrypt_nonce_pos[3] = { 76, 156, 236 };
+
+/* Whether a FastKDF round at bufptr reads any nonce byte:
+ * the key window is B[bufptr, bufptr + 32) and the input window
+ * is A[bufptr, bufptr + 64) */
+static uint neoscrypt_job_touches_nonce(uint bufptr) {
+    uint i;
+
+    for(i = 0; i < 3; i++) {
+        if((bufptr < neoscrypt_nonce_pos[i] + 4) &&
+          (neoscrypt_nonce_pos[i] < bufptr + 64))
+          return(1);
+    }
+
+    return(0);
+}
+
+/* Prepares a work unit: everything in the 1st FastKDF that does not
+ * depend on the nonce (header bytes 76 to 79) is done here once */
+void neoscrypt_job_init(neoscrypt_job *job, const uchar *header) {
+    uint S[64];
+
+    neoscrypt_copy(&job->header[0], &header[0], 76);
+    neoscrypt_erase(&job->header[76], 4);
+
+    neoscrypt_copy(&job->A[0],   &job->header[0], 80);
+    neoscrypt_copy(&job->A[80],  &job->header[0], 80);
+    neoscrypt_copy(&job->A[160], &job->header[0], 80);
+    neoscrypt_copy(&job->A[240], &job->header[0], 16);
+    neoscrypt_copy(&job->A[256], &job->header[0], 64);
+    neoscrypt_copy(&job->B[0],   &job->A[0], 288);
+
+    /* Round 0 always starts at bufptr 0 and never reaches the nonce;
+     * the rounds that follow depend on where bufptr lands */
+    for(job->rounds = 0, job->bufptr = 0; job->rounds < 32; job->rounds++) {
+        if(neoscrypt_job_touches_nonce(job->bufptr))
+          break;
+        job->bufptr = neoscrypt_fastkdf_rounds(job->A, job->B, S,
+          job->bufptr, job->rounds, job->rounds + 1);
+    }
+}
+
+/* Sets up FastKDF buffers A (320 bytes) and B (288 bytes) for a nonce;
+ * the skipped rounds may have XORed their digests over the zeroed
+ * nonce bytes of B, so the nonce is XORed in rather than copied */
+void neoscrypt_job_fill(const neoscrypt_job *job, uint nonce,
+  uchar *A, uchar *B) {
+    uint i;
+
+    neoscrypt_copy(A, job->A, 320);
+    neoscrypt_copy(B, job->B, 288);
+
+    for(i = 0; i < 3; i++) {
+        neoscrypt_copy(&A[neoscrypt_nonce_pos[i]], &nonce, 4);
+        neoscrypt_xor(&B[neoscrypt_nonce_pos[i]], &nonce, 4);
+    }
+}
+
+/* neoscrypt_job_core() with vtabs V tables, 1 or 2, in scratch */
+static void neoscrypt_job_vtabs(const neoscrypt_job *job, uint nonce,
+  uchar *output, uchar *scratch, uint vtabs) {
+    uint N = 128, r = 2;
+    uint bufptr;
+    uint *X, *S;
+    uchar *A, *B;
+
+    X = (uint *) scratch;
+    /* FastKDF buffers follow the V */
+    A = (uchar *) &X[(vtabs * N + 3) * 32 * r];
+    B = &A[320];
+    S = (uint *) &A[608];
+
+    /* X = KDF(password, salt) resumed after the skipped rounds */
+    neoscrypt_job_fill(job, nonce, A, B);
+    bufptr = neoscrypt_fastkdf_rounds(A, B, S, job->bufptr, job->rounds, 32);
+    neoscrypt_fastkdf_out(A, B, bufptr, (uchar *) X, 256);
+
+    if(vtabs == 2)
+      neoscrypt_mix_neoscrypt(X);
+    else
+      neoscrypt_mix_neoscrypt_1v(X);
+
+    /* output = KDF(password, X) with the same A */
+    neoscrypt_copy(&B[0],   &X[0], 256);
+    neoscrypt_copy(&B[256], &X[0], 32);
+    bufptr = neoscrypt_fastkdf_rounds(A, B, S, 0, 0, 32);
+    neoscrypt_fastkdf_out(A, B, bufptr, output, 32);
+}
+
+/* NeoScrypt of the job header with a nonce, same output as neoscrypt() */
+void neoscrypt_job_hash(const neoscrypt_job *job, uint nonce, uchar *output) {
+    const size_t stack_align = 0x40;
+
+#ifdef _MSC_VER
+    uchar *stack = (uchar *) malloc(NEOSCRYPT_STACK_SIZE + stack_align);
+#else
+    uchar stack[NEOSCRYPT_STACK_SIZE + stack_align];
+#endif
+
+    neoscrypt_job_vtabs(job, nonce, output,
+      (uchar *) (((size_t)stack & ~(stack_align - 1)) + stack_align), 1);
 
 #ifdef _MSC_VER
     free(stack);
 #endif
 }
+
+/* neoscrypt_job_hash() in caller supplied scratch, see neoscrypt_core() */
+void neoscrypt_job_core(const neoscrypt_job *job, uint nonce, uchar *output,
+  uchar *scratch) {
+    neoscrypt_job_vtabs(job, nonce, output, scratch, 2);
+}
@@ -1,9 +1,26 @@
+#ifndef NEOSCRYPT_H
+#define NEOSCRYPT_H
+
 #if (__cplusplus)
 extern "C" {
 #endif
 
 void neoscrypt(const unsigned char *password, unsigned char *output);
 
+/* Scratch taken by neoscrypt_core(): X, Z, Y, a V for each of X and Z
+ * and the FastKDF buffers */
+#define NEOSCRYPT_SCRATCH_SIZE ((2 * 128 + 3) * 256 + 864)
+
+void neoscrypt_core(const unsigned char *password, unsigned char *output,
+  unsigned char *scratch);
+
+/* 1 if the hash of password is at or below the 8-word target */
+int neoscrypt_check(const unsigned char *password, const unsigned int *target);
+
+/* NeoScrypt, Scrypt and their variants selected by a profile word */
+int neoscrypt_profile(const unsigned char *password, unsigned char *output,
+  unsigned int profile);
+
 void neoscrypt_blake2s(const void *input, const unsigned int input_size,
   const void *key, const unsigned char key_size,
   void *output, const unsigned char output_size);
@@ -12,6 +29,70 @@ void neoscrypt_copy(void *dstp, const void *srcp, unsigned int len);
 void neoscrypt_erase(void *dstp, unsigned int len);
 void neoscrypt_xor(void *dstp, const void *srcp, unsigned int len);
 
+void neoscrypt_fastkdf_opt(const unsigned char *password,
+  const unsigned char *salt, unsigned char *output, unsigned int mode);
+
+/* neoscrypt_bench() primitives */
+#define NEOSCRYPT_BENCH_SALSA   0
+#define NEOSCRYPT_BENCH_CHACHA  1
+#define NEOSCRYPT_BENCH_BLAKE2S 2
+#define NEOSCRYPT_BENCH_FASTKDF 3
+
+void neoscrypt_bench(unsigned int primitive, unsigned int iterations,
+  unsigned int *state);
+
+/* Vector extensions reported by neoscrypt_cpu_exts() */
+#define NEOSCRYPT_EXT_SSE2   0x01
+#define NEOSCRYPT_EXT_AVX2   0x02
+#define NEOSCRYPT_EXT_AVX512 0x04
+
+unsigned int neoscrypt_cpu_exts(void);
+
+/* Per thread scratch memory reused across hashes, 64-byte aligned;
+ * large enough for neoscrypt_core() and the widest SIMD engine */
+typedef struct neoscrypt_arena {
+    unsigned char *base;
+    unsigned char *mem;
+    unsigned long  size;
+    unsigned int   huge;
+} neoscrypt_arena;
+
+/* neoscrypt_arena_init() flags */
+#define NEOSCRYPT_ARENA_HUGE 0x01
+
+int  neoscrypt_arena_init(neoscrypt_arena *arena, unsigned int flags);
+void neoscrypt_arena_free(neoscrypt_arena *arena);
+
+/* Hashes lanes consecutive 80-byte inputs into lanes 32-byte outputs;
+ * groups of 16, 8 and 4 go through the widest SIMD engine available;
+ * arena may be NULL for a temporary one */
+void neoscrypt_multi(const unsigned char *password, unsigned char *output,
+  unsigned int lanes, neoscrypt_arena *arena);
+
+/* Work unit state for hashing nonce ranges of one 80-byte header;
+ * the leading FastKDF rounds which never read the nonce are done
+ * by neoscrypt_job_init() and skipped for every nonce afterwards */
+typedef struct neoscrypt_job {
+    unsigned char header[80];
+    unsigned char A[320];
+    unsigned char B[288];
+    unsigned int  rounds;
+    unsigned int  bufptr;
+} neoscrypt_job;
+
+void neoscrypt_job_init(neoscrypt_job *job, const unsigned char *header);
+void neoscrypt_job_fill(const neoscrypt_job *job, unsigned int nonce,
+  unsigned char *A, unsigned char *B);
+void neoscrypt_job_hash(const neoscrypt_job *job, unsigned int nonce,
+  unsigned char *output);
+void neoscrypt_job_core(const neoscrypt_job *job, unsigned int nonce,
+  unsigned char *output, unsigned char *scratch);
+
+/* Hashes count nonces from first_nonce into count 32-byte outputs;
+ * same engine selection and arena use as neoscrypt_multi() */
+void neoscrypt_job_multi(const neoscrypt_job *job, unsigned int first_nonce,
+  unsigned char *output, unsigned int count, neoscrypt_arena *arena);
+
 #if (__cplusplus)
 }
 #endif
@@ -55,3 +136,5 @@ typedef uchar hash_digest[DIGEST_SIZE];
 #define U64TO8_BE(p, v) \
     U32TO8_BE((p),     (uint)((v) >> 32)); \
     U32TO8_BE((p) + 4, (uint)((v)      ));
+
+#endif /* NEOSCRYPT_H */
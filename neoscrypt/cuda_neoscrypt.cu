@@ -8,10 +8,13 @@
 #include <cuda.h>
 #include <cuda_runtime.h>
 
+#include "cuda_neoscrypt.h"
+
 #ifndef MAX_GPUS
 #define MAX_GPUS 32
 #endif
 
+
 #ifdef _MSC_VER
 typedef unsigned int uint;
 typedef unsigned long long ulong;
@@ -102,18 +105,6 @@ static __forceinline__ __host__ __device__ void operator^=(uint8 &a, uint8 &b) {
       a.s7 ^= b.s7;
 }
 
-__device__ uint8 *G;
-__device__ uint8 *Tr;
-__device__ uint8 *Tr2;
-__device__ uint8 *Input;
-
-static uint *Nonce[MAX_GPUS];
-
-__constant__ uint hash_target;
-__constant__ __align__(16) uint key_init[16]; 
-__constant__ __align__(16) uint input_init[16];
-__constant__ __align__(16) uint c_data[64];
-
 static const uint8 BLAKE2s_IV_host = {
     0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
     0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
@@ -3272,7 +3263,8 @@ void blake2s_host(uint *inout, const uint *key) {
 #define TPB_MIX_MODE3 128
 
 __global__ __launch_bounds__(TPB, 1)
-void neoscrypt_gpu_hash_start(uint startNonce) {
+void neoscrypt_gpu_hash_start(uint startNonce, const uint *c_data,
+  const uint *input_init, const uint *key_init, uint8 *Input) {
     const uint thrid = blockDim.x * blockIdx.x + threadIdx.x;
     const uint shiftTr = thrid * 8;
     const uint nonce = thrid + startNonce;
@@ -3692,7 +3684,8 @@ void neoscrypt_gpu_hash_start(uint startNonce) {
 }
 
 __global__ __launch_bounds__(TPB, 1)
-void neoscrypt_gpu_hash_end(uint startNonce, uint *nonceVector) {
+void neoscrypt_gpu_hash_end(uint startNonce, const uint *c_data, uint hash_target,
+  const uint8 *Tr, const uint8 *Tr2, uint *nonceVector) {
     const uint thrid = blockDim.x * blockIdx.x + threadIdx.x;
     const uint shiftTr = thrid * 8;
     const uint nonce = thrid + startNonce;
@@ -4041,8 +4034,11 @@ void neoscrypt_gpu_hash_end(uint startNonce, uint *nonceVector) {
     asm("xor.b32 %0, %0, %1;" : "+r"(i) : "r"(input[7]));
     asm("xor.b32 %0, %0, %1;" : "+r"(i) : "r"(data7));
 
-    if(i <= hash_target)
-    asm("st.b32 [%1], %0;" : : "r"(nonce), __MEM_PTR(&nonceVector[0]));
+    if(i <= hash_target) {
+        j = atomicAdd(&nonceVector[0], 1);
+        if(j < MAX_NONCES)
+          nonceVector[j + 1] = nonce;
+    }
 }
 
 
@@ -4710,7 +4706,7 @@ void neoscrypt_chacha_mode3(uint4 *XV) {
 
 
 __global__ __launch_bounds__(TPB_MIX_MODE1, 1)
-void neoscrypt_gpu_hash_salsa_mode1() {
+void neoscrypt_gpu_hash_salsa_mode1(uint8 *G, uint8 *Tr, const uint8 *Input) {
     const uint thrid = blockDim.x * blockIdx.x + threadIdx.x;
     const uint membase = blockDim.x * blockIdx.x * 1024 * 2;
     const uint shiftTr = 8 * thrid;
@@ -4797,7 +4793,7 @@ void neoscrypt_gpu_hash_salsa_mode1() {
 }
 
 __global__ __launch_bounds__(TPB_MIX_MODE1, 1)
-void neoscrypt_gpu_hash_chacha_mode1() {
+void neoscrypt_gpu_hash_chacha_mode1(uint8 *G, uint8 *Tr2, const uint8 *Input) {
     const uint thrid = blockDim.x * blockIdx.x + threadIdx.x;
     const uint membase = blockDim.x * blockIdx.x * 1024 * 2;
     const uint shiftTr = 8 * thrid;
@@ -4884,7 +4880,7 @@ void neoscrypt_gpu_hash_chacha_mode1() {
 }
 
 __global__ __launch_bounds__(TPB_MIX_MODE2, 1)
-void neoscrypt_gpu_hash_salsa_mode2() {
+void neoscrypt_gpu_hash_salsa_mode2(uint8 *G, uint8 *Tr, const uint8 *Input) {
     const uint thrid = blockDim.x * blockIdx.x + threadIdx.x;
     const uint membase = thrid * 128 * 8;
     const uint shiftTr = thrid * 8;
@@ -4971,7 +4967,7 @@ void neoscrypt_gpu_hash_salsa_mode2() {
 }
 
 __global__ __launch_bounds__(TPB_MIX_MODE2, 1)
-void neoscrypt_gpu_hash_chacha_mode2() {
+void neoscrypt_gpu_hash_chacha_mode2(uint8 *G, uint8 *Tr2, const uint8 *Input) {
     const uint thrid = blockDim.x * blockIdx.x + threadIdx.x;
     const uint membase = (gridDim.x * blockDim.x + thrid) * 128 * 8;
     const uint shiftTr = thrid * 8;
@@ -5059,7 +5055,7 @@ void neoscrypt_gpu_hash_chacha_mode2() {
 
 
 __global__ __launch_bounds__(TPB_MIX_MODE3, 1)
-void neoscrypt_gpu_hash_salsa_mode3() {
+void neoscrypt_gpu_hash_salsa_mode3(uint8 *G, uint8 *Tr2, const uint8 *Input) {
     const uint thrid = blockDim.y * blockIdx.x + threadIdx.y;
     const uint shift = 128 * 9 * (thrid & 0x1FFF);
     const uint shiftTr = thrid * 8;
@@ -5107,7 +5103,7 @@ void neoscrypt_gpu_hash_salsa_mode3() {
 }
 
 __global__ __launch_bounds__(TPB_MIX_MODE3, 1)
-void neoscrypt_gpu_hash_chacha_mode3() {
+void neoscrypt_gpu_hash_chacha_mode3(uint8 *G, uint8 *Tr, const uint8 *Input) {
     const uint thrid = blockDim.y * blockIdx.x + threadIdx.y;
     const uint shift = 128 * 9 * (thrid & 0x1FFF) + 128 * 8;
     const uint shiftTr = thrid * 8;
@@ -5155,11 +5151,23 @@ void neoscrypt_gpu_hash_chacha_mode3() {
 }
 
 
-__host__ uint neoscrypt_hash(uint thr_id, uint throughput, uint startNonce,
-  uint hash_mode) {
-    uint result[MAX_GPUS] = { 0xFFFFFFFF };
-
-    cudaMemset(Nonce[thr_id], 0xFF, 4);
+/* Layout of neoscrypt_device_ctx.data */
+#define CTX_C_DATA 0
+#define CTX_INPUT_INIT 64
+#define CTX_KEY_INIT 80
+#define CTX_DATA_SIZE 96
+
+/* Queues a batch of throughput nonces from startNonce on; slot (0 or 1)
+ * selects the result ring, so the next batch can be queued before the
+ * results of this one are read by neoscrypt_hash_results() */
+__host__ void neoscrypt_hash_launch(neoscrypt_device_ctx *ctx, uint startNonce, uint slot) {
+    const uint throughput = ctx->throughput;
+    uint *ring = ctx->nonces + slot * NEOSCRYPT_RING;
+    cudaStream_t s0 = ctx->stream[0], s1 = ctx->stream[1];
+    uint8 *G = (uint8 *) ctx->gmem;
+    uint8 *Tr = (uint8 *) ctx->hash0;
+    uint8 *Tr2 = (uint8 *) ctx->hash1;
+    uint8 *Input = (uint8 *) ctx->hash2;
 
     dim3 grid(throughput / TPB, 1, 1);
     dim3 block(TPB, 1, 1);
@@ -5173,54 +5181,126 @@ __host__ uint neoscrypt_hash(uint thr_id, uint throughput, uint startNonce,
     dim3 grid_mix3((throughput * 4) / TPB_MIX_MODE3);
     dim3 block_mix3(4, TPB_MIX_MODE3 / 4);
 
-    cudaStream_t stream[2];
-    cudaStreamCreate(&stream[0]);
-    cudaStreamCreate(&stream[1]);
+    cudaMemsetAsync(ring, 0, sizeof(uint), s0);
+
+    neoscrypt_gpu_hash_start <<<grid, block, 0, s0>>> (startNonce,
+      ctx->data + CTX_C_DATA, ctx->data + CTX_INPUT_INIT, ctx->data + CTX_KEY_INIT, Input);
 
-    neoscrypt_gpu_hash_start <<<grid, block>>> (startNonce);
+    cudaEventRecord(ctx->started, s0);
+    cudaStreamWaitEvent(s1, ctx->started, 0);
 
-    switch(hash_mode) {
+    switch(ctx->hash_mode) {
 
         default:
         case(1):
-            neoscrypt_gpu_hash_salsa_mode1 <<<grid_mix1, block_mix1, 0, stream[0]>>> ();
-            neoscrypt_gpu_hash_chacha_mode1 <<<grid_mix1, block_mix1, 0, stream[1]>>> ();
+            neoscrypt_gpu_hash_salsa_mode1 <<<grid_mix1, block_mix1, 0, s0>>> (G, Tr, Input);
+            neoscrypt_gpu_hash_chacha_mode1 <<<grid_mix1, block_mix1, 0, s1>>> (G, Tr2, Input);
             break;
 
         case(2):
-            neoscrypt_gpu_hash_salsa_mode2 <<<grid_mix2, block_mix2, 0, stream[0]>>> ();
-            neoscrypt_gpu_hash_chacha_mode2 <<<grid_mix2, block_mix2, 0, stream[1]>>> ();
+            neoscrypt_gpu_hash_salsa_mode2 <<<grid_mix2, block_mix2, 0, s0>>> (G, Tr, Input);
+            neoscrypt_gpu_hash_chacha_mode2 <<<grid_mix2, block_mix2, 0, s1>>> (G, Tr2, Input);
             break;
 
         case(3):
-            neoscrypt_gpu_hash_salsa_mode3 <<<grid_mix3, block_mix3, 0, stream[0]>>> ();
-            neoscrypt_gpu_hash_chacha_mode3 <<<grid_mix3, block_mix3, 0, stream[1]>>> ();
+            neoscrypt_gpu_hash_salsa_mode3 <<<grid_mix3, block_mix3, 0, s0>>> (G, Tr2, Input);
+            neoscrypt_gpu_hash_chacha_mode3 <<<grid_mix3, block_mix3, 0, s1>>> (G, Tr, Input);
             break;
 
     }
 
-    cudaDeviceSynchronize();
+    cudaEventRecord(ctx->mixed, s1);
+    cudaStreamWaitEvent(s0, ctx->mixed, 0);
 
-    neoscrypt_gpu_hash_end <<<grid, block>>> (startNonce, Nonce[thr_id]);
+    neoscrypt_gpu_hash_end <<<grid, block, 0, s0>>> (startNonce,
+      ctx->data + CTX_C_DATA, ctx->target, Tr, Tr2, ring);
 
-    cudaMemcpy(&result[thr_id], Nonce[thr_id], sizeof(uint), cudaMemcpyDeviceToHost);
+    cudaMemcpyAsync(ctx->nonces_host + slot * NEOSCRYPT_RING, ring,
+      NEOSCRYPT_RING * sizeof(uint), cudaMemcpyDeviceToHost, s0);
+    cudaEventRecord(ctx->finished[slot], s0);
+}
+
+/* Waits for the batch queued to slot; the candidates found are stored
+ * to results[] and their number, at most MAX_NONCES, returned */
+__host__ uint neoscrypt_hash_results(neoscrypt_device_ctx *ctx, uint slot, uint *results) {
+    const uint *ring = ctx->nonces_host + slot * NEOSCRYPT_RING;
+    uint count, i;
+
+    cudaEventSynchronize(ctx->finished[slot]);
+
+    count = ring[0];
+    if(count > MAX_NONCES)
+      count = MAX_NONCES;
+    for(i = 0; i < count; i++)
+      results[i] = ring[i + 1];
+
+    return(count);
+}
+
+/* Allocates the buffers, streams and events of a context on the current
+ * device for ctx->throughput threads per batch */
+__host__ bool neoscrypt_init(neoscrypt_device_ctx *ctx) {
+    const size_t throughput = ctx->throughput;
+    uint i;
 
-    cudaStreamDestroy(stream[0]);
-    cudaStreamDestroy(stream[1]);
+    if((cudaMalloc(&ctx->gmem, 2 * 32768 * throughput) != cudaSuccess) ||
+      (cudaMalloc(&ctx->hash0, 256 * throughput) != cudaSuccess) ||
+      (cudaMalloc(&ctx->hash1, 256 * throughput) != cudaSuccess) ||
+      (cudaMalloc(&ctx->hash2, 256 * throughput) != cudaSuccess) ||
+      (cudaMalloc(&ctx->data, CTX_DATA_SIZE * sizeof(uint)) != cudaSuccess) ||
+      (cudaMalloc(&ctx->nonces, 2 * NEOSCRYPT_RING * sizeof(uint)) != cudaSuccess) ||
+      (cudaMallocHost(&ctx->nonces_host, 2 * NEOSCRYPT_RING * sizeof(uint)) != cudaSuccess))
+      return(false);
+
+    for(i = 0; i < 2; i++) {
+        if((cudaStreamCreate(&ctx->stream[i]) != cudaSuccess) ||
+          (cudaEventCreateWithFlags(&ctx->finished[i], cudaEventDisableTiming) != cudaSuccess))
+          return(false);
+    }
+    if((cudaEventCreateWithFlags(&ctx->started, cudaEventDisableTiming) != cudaSuccess) ||
+      (cudaEventCreateWithFlags(&ctx->mixed, cudaEventDisableTiming) != cudaSuccess))
+      return(false);
 
-    return(result[thr_id]);
+    return(true);
 }
 
-__host__ void neoscrypt_init(uint thr_id, uint *gmem, uint *hash0, uint *hash1, uint *hash2) {
-    cudaMemcpyToSymbolAsync(G, &gmem, sizeof(gmem), 0, cudaMemcpyHostToDevice);
-    cudaMemcpyToSymbolAsync(Tr, &hash0, sizeof(hash0), 0, cudaMemcpyHostToDevice);
-    cudaMemcpyToSymbolAsync(Tr2, &hash1, sizeof(hash1), 0, cudaMemcpyHostToDevice);
-    cudaMemcpyToSymbolAsync(Input, &hash2, sizeof(hash2), 0, cudaMemcpyHostToDevice);
-    cudaMalloc(&Nonce[thr_id], 4);
+/* Releases everything neoscrypt_init() allocated; safe on a context it
+ * failed to set up completely */
+__host__ void neoscrypt_free(neoscrypt_device_ctx *ctx) {
+    uint i;
+
+    for(i = 0; i < 2; i++) {
+        if(ctx->stream[i]) cudaStreamSynchronize(ctx->stream[i]);
+    }
+    for(i = 0; i < 2; i++) {
+        if(ctx->stream[i]) cudaStreamDestroy(ctx->stream[i]);
+        if(ctx->finished[i]) cudaEventDestroy(ctx->finished[i]);
+        ctx->stream[i] = NULL;
+        ctx->finished[i] = NULL;
+    }
+    if(ctx->started) cudaEventDestroy(ctx->started);
+    if(ctx->mixed) cudaEventDestroy(ctx->mixed);
+    ctx->started = NULL;
+    ctx->mixed = NULL;
+
+    cudaFree(ctx->gmem);
+    cudaFree(ctx->hash0);
+    cudaFree(ctx->hash1);
+    cudaFree(ctx->hash2);
+    cudaFree(ctx->data);
+    cudaFree(ctx->nonces);
+    cudaFreeHost(ctx->nonces_host);
+    ctx->gmem = ctx->hash0 = ctx->hash1 = ctx->hash2 = NULL;
+    ctx->data = ctx->nonces = ctx->nonces_host = NULL;
+
+    cudaGetLastError();
 }
 
-__host__ void neoscrypt_prehash(uint *pdata, const uint *ptarget) {
-    uint PaddedMessage[64], input[16], key[16] = {0}, i;
+/* Sets up the block header, FastKDF input and key and the target of the
+ * batches to come; ordered after the batches already queued */
+__host__ void neoscrypt_prehash(neoscrypt_device_ctx *ctx, const uint *pdata, const uint *ptarget) {
+    uint data[CTX_DATA_SIZE], input[16], key[16] = {0}, i;
+    uint *PaddedMessage = &data[CTX_C_DATA];
 
     for(i = 0; i < 19; i++) {
         PaddedMessage[i] = pdata[i];
@@ -5235,16 +5315,35 @@ __host__ void neoscrypt_prehash(uint *pdata, const uint *ptarget) {
     PaddedMessage[39] = 0;
     PaddedMessage[59] = 0;
 
-    ((uint8 *) input)[0] = ((uint8 *) pdata)[0];
-    ((uint8 *) input)[1] = ((uint8 *) pdata)[1];
-    ((uint8 *) key)[0] = ((uint8 *) pdata)[0];
+    ((uint8 *) input)[0] = ((const uint8 *) pdata)[0];
+    ((uint8 *) input)[1] = ((const uint8 *) pdata)[1];
+    ((uint8 *) key)[0] = ((const uint8 *) pdata)[0];
 
     blake2s_host(input, key);
 
-    cudaMemcpyToSymbolAsync(c_data, PaddedMessage, 256, 0, cudaMemcpyHostToDevice);
-    cudaMemcpyToSymbolAsync(input_init, input, 64, 0, cudaMemcpyHostToDevice);
-    cudaMemcpyToSymbolAsync(key_init, key, 64, 0, cudaMemcpyHostToDevice);
-    cudaMemcpyToSymbolAsync(hash_target, &ptarget[7], 4, 0, cudaMemcpyHostToDevice);
+    for(i = 0; i < 16; i++) {
+        data[CTX_INPUT_INIT + i] = input[i];
+        data[CTX_KEY_INIT + i] = key[i];
+    }
+    ctx->target = ptarget[7];
+
+    cudaMemcpyAsync(ctx->data, data, sizeof(data), cudaMemcpyHostToDevice, ctx->stream[0]);
 
     cudaGetLastError();
 }
+
+/* BLAKE2s of a 64-byte input with a 32-byte key as done by
+ * neoscrypt_prehash() above; used by the self test */
+__host__ void neoscrypt_blake2s_host(const uint *input, const uint *key, uint *output) {
+    uint inout[16], pkey[16] = {0}, i;
+
+    for(i = 0; i < 16; i++)
+      inout[i] = input[i];
+    for(i = 0; i < 8; i++)
+      pkey[i] = key[i];
+
+    blake2s_host(inout, pkey);
+
+    for(i = 0; i < 8; i++)
+      output[i] = inout[i];
+}
@@ -0,0 +1,46 @@
+#ifndef CUDA_NEOSCRYPT_H
+#define CUDA_NEOSCRYPT_H
+
+#include <cuda_runtime.h>
+
+/* Result rings, one per batch in flight: the number of nonces found,
+ * then up to MAX_NONCES of them */
+#ifndef MAX_NONCES
+#define MAX_NONCES 16
+#endif
+#define NEOSCRYPT_RING (MAX_NONCES + 1)
+
+/* Everything one miner thread owns on its CUDA device; several of them
+ * may share a device with --gputhreads, so no kernel touches any state
+ * that is not passed to it from here */
+typedef struct {
+    int device;
+    /* tuning */
+    uint throughput;
+    uint hash_mode;
+    /* scratch of the FastKDF and SMix kernels */
+    uint *gmem;
+    uint *hash0;
+    uint *hash1;
+    uint *hash2;
+    /* block header words, FastKDF input and key set by neoscrypt_prehash() */
+    uint *data;
+    uint target;
+    /* result rings on the device and their pinned host copies */
+    uint *nonces;
+    uint *nonces_host;
+    /* the Salsa SMix runs on stream 0 with the start and end kernels,
+     * ChaCha on stream 1 */
+    cudaStream_t stream[2];
+    cudaEvent_t started;
+    cudaEvent_t mixed;
+    cudaEvent_t finished[2];
+} neoscrypt_device_ctx;
+
+extern bool neoscrypt_init(neoscrypt_device_ctx *ctx);
+extern void neoscrypt_free(neoscrypt_device_ctx *ctx);
+extern void neoscrypt_prehash(neoscrypt_device_ctx *ctx, const uint *pdata, const uint *ptarget);
+extern void neoscrypt_hash_launch(neoscrypt_device_ctx *ctx, uint startNonce, uint slot);
+extern uint neoscrypt_hash_results(neoscrypt_device_ctx *ctx, uint slot, uint *results);
+
+#endif
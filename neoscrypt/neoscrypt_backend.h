@@ -0,0 +1,29 @@
+#ifndef NEOSCRYPT_BACKEND_H
+#define NEOSCRYPT_BACKEND_H
+
+/* Hashing backends behind scanhash_neoscrypt(), one context per miner
+ * thread:
+ *   init()       sets up the context and returns the nonces per batch;
+ *   prehash()    sets the block header and target of the batches to come;
+ *   hash_batch() queues a batch from startNonce on to the result ring of
+ *                slot (0 or 1), so two of them may be in flight;
+ *   results()    waits for the batch of slot and stores the nonces whose
+ *                hash has the top word at or below the target, at most
+ *                MAX_NONCES of them, returning their number;
+ *   shutdown()   releases the context.
+ * The candidates are verified on the CPU by the caller. */
+typedef struct neoscrypt_backend {
+    const char *name;
+    void *(*init)(int thr_id, uint hash_mode, uint *throughput);
+    void (*prehash)(void *ctx, const uint *pdata, const uint *ptarget);
+    void (*hash_batch)(void *ctx, uint startNonce, uint slot);
+    uint (*results)(void *ctx, uint slot, uint *results);
+    void (*shutdown)(void *ctx);
+} neoscrypt_backend;
+
+/* CUDA devices */
+extern const neoscrypt_backend neoscrypt_backend_cuda;
+/* The same on the CPU, see --virtual-gpus */
+extern const neoscrypt_backend neoscrypt_backend_vgpu;
+
+#endif
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../neoscrypt.h"
+
+#include "miner.h"
+#include "log.h"
+#include "neoscrypt_backend.h"
+
+#ifdef _MSC_VER
+#define __func__ __FUNCTION__
+#endif
+
+/* Nonces hashed per neoscrypt_job_multi() call, a multiple of 16 lanes */
+#define VGPU_CHUNK 64
+
+/* Virtual GPU: the CUDA backend run on the CPU, so that everything
+ * around the hashing can be tested on hosts without a CUDA device;
+ * a batch is hashed right away by hash_batch() and only its result
+ * ring is left for results() to read, just like on the device */
+typedef struct {
+    uint throughput;
+    uint target;
+    neoscrypt_job job;
+    neoscrypt_arena arena;
+    uint ring[2][MAX_NONCES + 1];
+} vgpu_ctx;
+
+static void *vgpu_init(int thr_id, uint hash_mode, uint *throughput) {
+    vgpu_ctx *ctx;
+
+    ctx = (vgpu_ctx *) calloc(1, sizeof(vgpu_ctx));
+    if(!ctx)
+      return(NULL);
+
+    if(neoscrypt_arena_init(&ctx->arena, opt_hugepages ? NEOSCRYPT_ARENA_HUGE : 0)) {
+        gpulog(LOG_ERR, thr_id, "Unable to allocate scratch memory");
+        free(ctx);
+        return(NULL);
+    }
+
+    /* Intensity 10 by default, which takes a second or so per batch */
+    ctx->throughput = device_intensity(device_map[thr_id], __func__, 1U << 10) / 2;
+    ctx->throughput = (ctx->throughput + 15) & ~15U;
+    if(!ctx->throughput)
+      ctx->throughput = 16;
+
+    gpulog(LOG_INFO, thr_id, "Virtual GPU, %u threads per batch", ctx->throughput * 2);
+
+    *throughput = ctx->throughput;
+    return(ctx);
+}
+
+static void vgpu_prehash(void *ctx, const uint *pdata, const uint *ptarget) {
+    vgpu_ctx *vgpu = (vgpu_ctx *) ctx;
+
+    neoscrypt_job_init(&vgpu->job, (const uchar *) pdata);
+    vgpu->target = ptarget[7];
+}
+
+static void vgpu_hash_batch(void *ctx, uint startNonce, uint slot) {
+    vgpu_ctx *vgpu = (vgpu_ctx *) ctx;
+    uint hash[VGPU_CHUNK * 8], *ring = vgpu->ring[slot];
+    uint nonce, count, i;
+
+    /* Same as the end kernel: every match is counted,
+     * the first MAX_NONCES of them are stored */
+    ring[0] = 0;
+    for(nonce = 0; nonce < vgpu->throughput; nonce += count) {
+        count = MIN(VGPU_CHUNK, vgpu->throughput - nonce);
+        neoscrypt_job_multi(&vgpu->job, startNonce + nonce, (uchar *) hash, count, &vgpu->arena);
+        for(i = 0; i < count; i++) {
+            if(hash[i * 8 + 7] <= vgpu->target) {
+                if(ring[0] < MAX_NONCES)
+                  ring[ring[0] + 1] = startNonce + nonce + i;
+                ring[0]++;
+            }
+        }
+    }
+}
+
+static uint vgpu_results(void *ctx, uint slot, uint *results) {
+    const uint *ring = ((vgpu_ctx *) ctx)->ring[slot];
+    uint count = MIN(ring[0], MAX_NONCES), i;
+
+    for(i = 0; i < count; i++)
+      results[i] = ring[i + 1];
+
+    return(count);
+}
+
+static void vgpu_shutdown(void *ctx) {
+    vgpu_ctx *vgpu = (vgpu_ctx *) ctx;
+
+    neoscrypt_arena_free(&vgpu->arena);
+    free(vgpu);
+}
+
+const neoscrypt_backend neoscrypt_backend_vgpu = {
+    "virtual GPU",
+    vgpu_init,
+    vgpu_prehash,
+    vgpu_hash_batch,
+    vgpu_results,
+    vgpu_shutdown
+};
@@ -7,146 +7,395 @@
 
 #include "miner.h"
 #include "log.h"
+#include "cuda_neoscrypt.h"
+#include "neoscrypt_backend.h"
 
 #ifdef _MSC_VER
 #define __func__ __FUNCTION__
 #include <stdio.h>
 #endif
 
-static uint *gmem[MAX_GPUS];
-static uint *hash0[MAX_GPUS];
-static uint *hash1[MAX_GPUS];
-static uint *hash2[MAX_GPUS];
-
-extern void neoscrypt_init(uint thr_id, uint *gmem,
-  uint *hash0, uint *hash1, uint *hash2);
-extern void neoscrypt_prehash(uint *data, const uint *ptarget);
-extern uint neoscrypt_hash(uint thr_id, uint throughput, uint startNonce, uint hash_mode);
-
-extern "C" int scanhash_neoscrypt(int thr_id, uint *pdata, const uint *ptarget,
-  uint max_nonce, uint64_t *hashes_done, uint hash_mode) {
-    const uint first_nonce = pdata[19];
-    uint foundNonce;
+/* Backend and its context per miner thread, set up on its first scan */
+static struct {
+    const neoscrypt_backend *backend;
+    void *ctx;
+    uint throughput;
+} thr_backend[MAX_GPUS];
+
+/* Defaults of the known devices, the first name matched wins; CUDA
+ * threads per scan and hash mode */
+static const struct {
+    const char *name;
+    uint throughput;
+    uint hash_mode;
+} neoscrypt_defaults[] = {
+    { "TITAN Xp",    30 * 128 * 32, 3 },
+    { "1080 Ti",     28 * 128 * 32, 3 },
+    { "1080",        20 * 128 * 32, 3 },
+    { "1070 Ti",     19 * 128 * 32, 2 },
+    { "1070",        15 * 128 * 64, 2 },
+    { "1060 6GB",    10 * 128 * 64, 2 },
+    { "1060 3GB",     9 * 128 * 32, 2 },
+    { "TITAN X",     24 * 128 * 32, 1 },
+    { "980 Ti",      22 * 128 * 32, 1 },
+    { "980",         16 * 128 * 32, 1 },
+    { "970",         13 * 128 * 32, 1 },
+    { "960",          8 * 128 * 32, 1 },
+    { "950",          6 * 128 * 64, 1 },
+    { "750 Ti",       5 * 128 * 64, 1 },
+    { "750",          4 * 128 * 64, 1 },
+    { "TITAN Z",     15 * 192 * 32, 1 },
+    { "TITAN Black", 15 * 192 * 32, 1 },
+    { "TITAN",       14 * 192 * 32, 1 },
+    { "780 Ti",      15 * 192 * 16, 1 },
+    { "780",         12 * 192 * 16, 1 },
+};
+
+/* Device memory per CUDA thread of a half batch */
+#define TUNE_THREAD_MEM (2 * 32768 + 3 * 256)
+/* Batches timed per candidate */
+#define TUNE_BATCHES 4
+
+static pthread_mutex_t tune_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Sets the default throughput (of a half batch) and hash mode of ctx;
+ * devices not in the table get 4096 threads per SM in mode 1 */
+static void neoscrypt_tune_default(const cudaDeviceProp *props, neoscrypt_device_ctx *ctx) {
+    uint throughput = props->multiProcessorCount * 128 * 32, i;
+
+    ctx->hash_mode = 1;
+    for(i = 0; i < ARRAY_SIZE(neoscrypt_defaults); i++) {
+        if(strstr(props->name, neoscrypt_defaults[i].name)) {
+            throughput = neoscrypt_defaults[i].throughput;
+            ctx->hash_mode = neoscrypt_defaults[i].hash_mode;
+            break;
+        }
+    }
+#if defined(_WIN32) && !defined(_WIN64)
+    if(throughput > 49152) throughput = 49152;
+#endif
 
-    if(opt_benchmark)
-      ((uint *) ptarget)[7] = 0x01FF;
+    ctx->throughput = throughput / 2;
+}
 
-    uint intensity = 1, throughput = 0;
-    cudaDeviceProp props;
-    cudaGetDeviceProperties(&props, device_map[thr_id]);
-    if(strstr(props.name, "TITAN Xp")) {
-        throughput = 30 * 128 * 32;
-        if(!hash_mode) hash_mode = 3;
-    }
-    else if(strstr(props.name, "1080 Ti")) {
-        throughput = 28 * 128 * 32;
-        if(!hash_mode) hash_mode = 3;
-    }
-    else if(strstr(props.name, "1080")) {
-        throughput = 20 * 128 * 32;
-        if(!hash_mode) hash_mode = 3;
-    }
-    else if(strstr(props.name, "1070 Ti")) {
-        throughput = 19 * 128 * 32;
-        if(!hash_mode) hash_mode = 2;
-    }
-    else if(strstr(props.name, "1070")) {
-        throughput = 15 * 128 * 64;
-        if(!hash_mode) hash_mode = 2;
-    }
-    else if(strstr(props.name, "1060 6GB")) {
-        throughput = 10 * 128 * 64;
-        if(!hash_mode) hash_mode = 2;
-    }
-    else if(strstr(props.name, "1060 3GB")) {
-        throughput = 9 * 128 * 32;
-        if(!hash_mode) hash_mode = 2;
-    }
-    else if(strstr(props.name, "TITAN X")) {
-        throughput = 24 * 128 * 32;
-        if(!hash_mode) hash_mode = 1;
-    }
-    else if(strstr(props.name, "980 Ti")) {
-        throughput = 22 * 128 * 32;
-        if(!hash_mode) hash_mode = 1;
-    }
-    else if(strstr(props.name, "980")) {
-        throughput = 16 * 128 * 32;
-        if(!hash_mode) hash_mode = 1;
-    }
-    else if(strstr(props.name, "970")) {
-        throughput = 13 * 128 * 32;
-        if(!hash_mode) hash_mode = 1;
-    }
-    else if(strstr(props.name, "960")) {
-        throughput = 8 * 128 * 32;
-        if(!hash_mode) hash_mode = 1;
+/* Hashes per second of ctx->throughput and ctx->hash_mode as measured
+ * over a few batches; 0 if the buffers do not fit or the kernels fail or
+ * return nonces the CPU does not confirm */
+static double neoscrypt_tune_rate(neoscrypt_device_ctx *ctx) {
+    uint data[20], target[8] = {0}, found[MAX_NONCES], count, i, j;
+    struct timeval start, end;
+    double elapsed;
+    bool valid = true;
+
+    if(!neoscrypt_init(ctx)) {
+        neoscrypt_free(ctx);
+        return(0.0);
     }
-    else if(strstr(props.name, "950")) {
-        throughput = 6 * 128 * 64;
-        if(!hash_mode) hash_mode = 1;
+
+    /* A few candidates expected per batch to check the results by */
+    for(i = 0; i < 20; i++)
+      data[i] = i * 0x9E3779B9U;
+    target[7] = (uint) ((4ULL << 32) / ctx->throughput);
+    neoscrypt_prehash(ctx, data, target);
+
+    /* The first batch warms up and checks the kernels */
+    neoscrypt_hash_launch(ctx, 0, 0);
+    count = neoscrypt_hash_results(ctx, 0, found);
+    for(j = 0; j < count; j++) {
+        data[19] = found[j];
+        if(!neoscrypt_check((uchar *) data, target))
+          valid = false;
     }
-    else if(strstr(props.name, "750 Ti")) {
-        throughput = 5 * 128 * 64;
-        if(!hash_mode) hash_mode = 1;
+
+    gettimeofday(&start, NULL);
+    for(i = 1; i <= TUNE_BATCHES; i++)
+      neoscrypt_hash_launch(ctx, i * ctx->throughput, i & 1);
+    neoscrypt_hash_results(ctx, TUNE_BATCHES & 1, found);
+    gettimeofday(&end, NULL);
+
+    if(cudaGetLastError() != cudaSuccess)
+      valid = false;
+
+    neoscrypt_free(ctx);
+
+    elapsed = (double) (end.tv_sec - start.tv_sec) +
+      (double) (end.tv_usec - start.tv_usec) * 1e-6;
+    if(!valid || (elapsed <= 0.0))
+      return(0.0);
+
+    return((double) ctx->throughput * TUNE_BATCHES / elapsed);
+}
+
+/* Times every hash mode (or just hash_mode if non-zero) at 1024 to 8192
+ * CUDA threads per SM, both batches in flight, (or just throughput if
+ * non-zero) as far as the free device memory allows and keeps the
+ * fastest in ctx; returns its rate, 0 if none ran */
+static double neoscrypt_tune(int thr_id, const cudaDeviceProp *props,
+  neoscrypt_device_ctx *ctx, uint hash_mode, uint throughput) {
+    neoscrypt_device_ctx test;
+    size_t mem_free = 0, mem_total = 0;
+    uint mode, k, best_throughput = 0, best_mode = 0;
+    double rate, best = 0.0;
+
+    gpulog(LOG_INFO, thr_id, "Auto-tuning, this takes a while...");
+
+    for(mode = 1; mode <= 3; mode++) {
+        if(hash_mode && (mode != hash_mode))
+          continue;
+
+        for(k = 8; k <= 64; k *= 2) {
+            memset(&test, 0, sizeof(test));
+            test.device = ctx->device;
+            test.hash_mode = mode;
+            test.throughput = throughput ? throughput :
+              props->multiProcessorCount * 64 * k;
+#if defined(_WIN32) && !defined(_WIN64)
+            if(test.throughput > 24576) break;
+#endif
+            /* the previous candidate is released by now, but another
+             * thread may have taken memory of the device meanwhile */
+            if((cudaMemGetInfo(&mem_free, &mem_total) != cudaSuccess) ||
+              ((size_t) test.throughput * TUNE_THREAD_MEM > mem_free / 10 * 9)) {
+                if(opt_debug)
+                  gpulog(LOG_DEBUG, thr_id, "Mode %u, %u CUDA threads: %u MB free, skipped",
+                    mode, test.throughput * 2, (uint) (mem_free >> 20));
+                break;
+            }
+
+            rate = neoscrypt_tune_rate(&test);
+            if(opt_debug)
+              gpulog(LOG_DEBUG, thr_id, "Mode %u, %u CUDA threads: %.2f kH/s",
+                mode, test.throughput * 2, rate * 1e-3);
+            if(rate > best) {
+                best = rate;
+                best_mode = mode;
+                best_throughput = test.throughput;
+            }
+
+            if(throughput)
+              break;
+        }
     }
-    else if(strstr(props.name, "750")) {
-        throughput = 4 * 128 * 64;
-        if(!hash_mode) hash_mode = 1;
+
+    if(best > 0.0) {
+        ctx->hash_mode = best_mode;
+        ctx->throughput = best_throughput;
+        gpulog(LOG_INFO, thr_id, "Auto-tuned to mode %u, %u CUDA threads, %.2f kH/s",
+          best_mode, best_throughput * 2, best * 1e-3);
+    } else
+      gpulog(LOG_WARNING, thr_id, "Auto-tuning failed, using the defaults");
+
+    return(best);
+}
+
+/* The tuning cache is a JSON object with an array of devices, each with
+ * the name, SM version and driver version it was tuned for */
+static json_t *neoscrypt_tune_load(void) {
+    json_error_t err;
+    json_t *cache;
+
+#if JANSSON_VERSION_HEX >= 0x020000
+    cache = json_load_file(opt_tune_cache, 0, &err);
+#else
+    cache = json_load_file(opt_tune_cache, &err);
+#endif
+    if(!json_is_object(cache) || !json_is_array(json_object_get(cache, "devices"))) {
+        if(cache)
+          json_decref(cache);
+        cache = json_object();
+        json_object_set_new(cache, "devices", json_array());
     }
-    else if(strstr(props.name, "TITAN Z")) {
-        throughput = 15 * 192 * 32;
-        if(!hash_mode) hash_mode = 1;
+
+    return(cache);
+}
+
+static json_t *neoscrypt_tune_find(json_t *cache, const cudaDeviceProp *props, int driver) {
+    json_t *devices = json_object_get(cache, "devices"), *dev, *name;
+    size_t i;
+
+    for(i = 0; i < json_array_size(devices); i++) {
+        dev = json_array_get(devices, i);
+        name = json_object_get(dev, "name");
+        if(json_is_string(name) && !strcmp(json_string_value(name), props->name) &&
+          (json_integer_value(json_object_get(dev, "sm")) == props->major * 10 + props->minor) &&
+          (json_integer_value(json_object_get(dev, "driver")) == driver))
+          return(dev);
     }
-    else if(strstr(props.name, "TITAN Black")) {
-        throughput = 15 * 192 * 32;
-        if(!hash_mode) hash_mode = 1;
+
+    return(NULL);
+}
+
+/* Takes the throughput and hash mode of ctx from the cache if tuned
+ * before for this device and driver */
+static bool neoscrypt_tune_lookup(int thr_id, const cudaDeviceProp *props, int driver,
+  neoscrypt_device_ctx *ctx) {
+    json_t *cache = neoscrypt_tune_load(), *dev;
+    uint throughput, mode;
+    bool found = false;
+
+    dev = neoscrypt_tune_find(cache, props, driver);
+    if(dev) {
+        throughput = (uint) json_integer_value(json_object_get(dev, "throughput"));
+        mode = (uint) json_integer_value(json_object_get(dev, "hash_mode"));
+        if(throughput && (mode >= 1) && (mode <= 3)) {
+            ctx->throughput = throughput / 2;
+            ctx->hash_mode = mode;
+            found = true;
+            gpulog(LOG_INFO, thr_id, "Using tuned mode %u, %u CUDA threads from %s",
+              mode, throughput, opt_tune_cache);
+        }
     }
-    else if(strstr(props.name, "TITAN")) {
-        throughput = 14 * 192 * 32;
-        if(!hash_mode) hash_mode = 1;
+
+    json_decref(cache);
+    return(found);
+}
+
+static void neoscrypt_tune_store(int thr_id, const cudaDeviceProp *props, int driver,
+  const neoscrypt_device_ctx *ctx, double rate) {
+    json_t *cache = neoscrypt_tune_load(), *dev;
+
+    dev = neoscrypt_tune_find(cache, props, driver);
+    if(!dev) {
+        dev = json_object();
+        json_array_append_new(json_object_get(cache, "devices"), dev);
     }
-    else if(strstr(props.name, "780 Ti")) {
-        throughput = 15 * 192 * 16;
-        if(!hash_mode) hash_mode = 1;
+    json_object_set_new(dev, "name", json_string(props->name));
+    json_object_set_new(dev, "sm", json_integer(props->major * 10 + props->minor));
+    json_object_set_new(dev, "driver", json_integer(driver));
+    json_object_set_new(dev, "throughput", json_integer(ctx->throughput * 2));
+    json_object_set_new(dev, "hash_mode", json_integer(ctx->hash_mode));
+    json_object_set_new(dev, "hashrate", json_real(rate));
+
+    if(json_dump_file(cache, opt_tune_cache, JSON_INDENT(2)))
+      gpulog(LOG_WARNING, thr_id, "Unable to save the tuning to %s", opt_tune_cache);
+
+    json_decref(cache);
+}
+
+/* Picks the throughput and hash mode for the device of thr_id and
+ * allocates its context; hash_mode and the intensity override the
+ * default or tuned values if set */
+static neoscrypt_device_ctx *neoscrypt_device_init(int thr_id, uint hash_mode) {
+    const int dev_id = device_map[thr_id];
+    const uint intensity = gpus_intensity[dev_id];
+    neoscrypt_device_ctx *ctx;
+    cudaDeviceProp props;
+    int driver = 0;
+    double rate;
+
+    cudaGetDeviceProperties(&props, dev_id);
+    cudaDriverGetVersion(&driver);
+
+    ctx = (neoscrypt_device_ctx *) calloc(1, sizeof(neoscrypt_device_ctx));
+    if(!ctx)
+      return(NULL);
+
+    ctx->device = dev_id;
+
+    /* No device reset here: other threads may share the device */
+    cudaSetDevice(dev_id);
+    cudaSetDeviceFlags(cudaDeviceScheduleBlockingSync);
+    cudaDeviceSetCacheConfig(cudaFuncCachePreferL1);
+    cudaGetLastError();
+
+    neoscrypt_tune_default(&props, ctx);
+
+    /* Tuned once per device and driver, the other threads of the device
+     * wait for it and take the result from the cache */
+    if(opt_autotune && !(hash_mode && intensity)) {
+        pthread_mutex_lock(&tune_lock);
+        if(!neoscrypt_tune_lookup(thr_id, &props, driver, ctx)) {
+            rate = neoscrypt_tune(thr_id, &props, ctx, hash_mode, intensity / 2);
+            if((rate > 0.0) && !hash_mode && !intensity)
+              neoscrypt_tune_store(thr_id, &props, driver, ctx, rate);
+        }
+        pthread_mutex_unlock(&tune_lock);
     }
-    else if(strstr(props.name, "780")) {
-        throughput = 12 * 192 * 16;
-        if(!hash_mode) hash_mode = 1;
+
+    if(hash_mode)
+      ctx->hash_mode = hash_mode;
+    ctx->throughput = device_intensity(dev_id, __func__, ctx->throughput * 2) / 2;
+
+    gpulog(LOG_INFO, thr_id, "Intensity set to %g, %u CUDA threads",
+      throughput2intensity(ctx->throughput * 2), ctx->throughput * 2);
+
+    if(!neoscrypt_init(ctx)) {
+        gpulog(LOG_ERR, thr_id, "Unable to allocate the device buffers: %s",
+          cudaGetErrorString(cudaGetLastError()));
+        neoscrypt_free(ctx);
+        free(ctx);
+        return(NULL);
     }
-    else
-      intensity = 14;
 
-    if(!throughput) throughput = 1U << intensity;
+    return(ctx);
+}
 
-#if defined(_WIN32) && !defined(_WIN64)
-    if(throughput > 49152) throughput = 49152;
-#endif
+static void *cuda_backend_init(int thr_id, uint hash_mode, uint *throughput) {
+    neoscrypt_device_ctx *ctx = neoscrypt_device_init(thr_id, hash_mode);
 
-    throughput = device_intensity(device_map[thr_id], __func__, throughput) / 2;
+    if(ctx)
+      *throughput = ctx->throughput;
 
-    static bool init[MAX_GPUS] = { 0 };
+    return(ctx);
+}
 
-    if(!init[thr_id]) {
-        cudaSetDevice(device_map[thr_id]);
-        cudaDeviceReset();
-        cudaSetDeviceFlags(cudaDeviceScheduleBlockingSync);
-        cudaDeviceSetCacheConfig(cudaFuncCachePreferL1);
-        cudaGetLastError();
+static void cuda_backend_prehash(void *ctx, const uint *pdata, const uint *ptarget) {
+    neoscrypt_prehash((neoscrypt_device_ctx *) ctx, pdata, ptarget);
+}
 
-        gpulog(LOG_INFO, thr_id, "Intensity set to %g, %u CUDA threads",
-          throughput2intensity(throughput * 2), throughput * 2);
+static void cuda_backend_hash_batch(void *ctx, uint startNonce, uint slot) {
+    neoscrypt_hash_launch((neoscrypt_device_ctx *) ctx, startNonce, slot);
+}
 
-        cudaMalloc(&gmem[thr_id], 2 * 32768 * throughput);
-        cudaMalloc(&hash0[thr_id], 256 * throughput);
-        cudaMalloc(&hash1[thr_id], 256 * throughput);
-        cudaMalloc(&hash2[thr_id], 256 * throughput);
+static uint cuda_backend_results(void *ctx, uint slot, uint *results) {
+    return(neoscrypt_hash_results((neoscrypt_device_ctx *) ctx, slot, results));
+}
 
-        neoscrypt_init(thr_id, gmem[thr_id],
-          hash0[thr_id], hash1[thr_id], hash2[thr_id]);
+static void cuda_backend_shutdown(void *ctx) {
+    neoscrypt_free((neoscrypt_device_ctx *) ctx);
+    free(ctx);
+}
 
-        init[thr_id] = true;
+const neoscrypt_backend neoscrypt_backend_cuda = {
+    "CUDA",
+    cuda_backend_init,
+    cuda_backend_prehash,
+    cuda_backend_hash_batch,
+    cuda_backend_results,
+    cuda_backend_shutdown
+};
+
+/* Releases the backend context of a miner thread on its way out */
+extern "C" void scanhash_neoscrypt_free(int thr_id) {
+
+    if(thr_backend[thr_id].ctx) {
+        thr_backend[thr_id].backend->shutdown(thr_backend[thr_id].ctx);
+        thr_backend[thr_id].ctx = NULL;
     }
+}
+
+extern "C" int scanhash_neoscrypt(int thr_id, uint *pdata, const uint *ptarget,
+  uint max_nonce, uint64_t *hashes_done, uint hash_mode, uint *nonces) {
+    const uint first_nonce = pdata[19];
+    uint found[MAX_NONCES], count, throughput;
+    uint start[2], next, launched = 0, done = 0;
+    const neoscrypt_backend *backend;
+    void *ctx;
+    int rc = 0;
+
+    if(opt_benchmark)
+      ((uint *) ptarget)[7] = 0x01FF;
+
+    if(!thr_backend[thr_id].ctx) {
+        backend = opt_virtual_gpus ? &neoscrypt_backend_vgpu : &neoscrypt_backend_cuda;
+        thr_backend[thr_id].ctx = backend->init(thr_id, hash_mode, &thr_backend[thr_id].throughput);
+        if(!thr_backend[thr_id].ctx)
+          proper_exit(EXIT_CODE_CUDA_ERROR);
+        thr_backend[thr_id].backend = backend;
+    }
+    backend = thr_backend[thr_id].backend;
+    ctx = thr_backend[thr_id].ctx;
+    throughput = thr_backend[thr_id].throughput;
 
     /* Input data must be little endian already */
 
@@ -156,37 +405,55 @@ extern "C" int scanhash_neoscrypt(int thr_id, uint *pdata, const uint *ptarget,
     for(i = 0; i < 20; i++)
       data[i] = pdata[i];
 
-    neoscrypt_prehash(data, ptarget);
+    backend->prehash(ctx, data, ptarget);
 
-    while(!work_restart[thr_id].restart &&
-     ((ullong)max_nonce > ((ullong)(pdata[19]) + (ullong)throughput))) {
+    /* Two batches in flight: the next one is queued before the results
+     * of the previous one are read back and verified, so the GPU keeps
+     * busy meanwhile; nothing new is queued after a restart or a find */
+    next = pdata[19];
 
-        foundNonce = neoscrypt_hash(thr_id, throughput, pdata[19], hash_mode);
+    for(;;) {
 
-        if(foundNonce != 0xFFFFFFFF) {
+        if(!work_restart[thr_id].restart && !rc && ((launched - done) < 2) &&
+         ((ullong)max_nonce > ((ullong)next + (ullong)throughput))) {
+            start[launched & 1] = next;
+            backend->hash_batch(ctx, next, launched & 1);
+            next += throughput;
+            launched++;
+            if((launched - done) < 2)
+              continue;
+        }
 
-            if(opt_benchmark)
-              gpulog(LOG_INFO, thr_id, "nonce 0x%08X found", foundNonce);
+        if(done == launched)
+          break;
 
-            uint vhash64[8];
-            data[19] = foundNonce;
+        count = backend->results(ctx, done & 1, found);
 
-            neoscrypt((uchar *) data, (uchar *) vhash64);
+        /* Every candidate of the batch is verified, not just the first */
+        for(i = 0; (i < count) && (rc < MAX_NONCES); i++) {
 
-            if(vhash64[7] <= ptarget[7]) {
-                pdata[19] = foundNonce;
-                *hashes_done = foundNonce - first_nonce + 1;
-                return(1);
-            } else {
-                *hashes_done = foundNonce - first_nonce + 1;
-                gpulog(LOG_INFO, thr_id, "nonce 0x%08X fails CPU verification!", foundNonce);
-            }
+            if(opt_benchmark)
+              gpulog(LOG_INFO, thr_id, "nonce 0x%08X found", found[i]);
+
+            data[19] = found[i];
+
+            if(neoscrypt_check((uchar *) data, ptarget))
+              nonces[rc++] = found[i];
+            else
+              gpulog(LOG_INFO, thr_id, "nonce 0x%08X fails CPU verification!", found[i]);
 
         }
 
-        pdata[19] += throughput;
+        pdata[19] = start[done & 1] + throughput;
+        done++;
 
-    } 
+    }
+
+    if(rc) {
+        *hashes_done = pdata[19] - first_nonce;
+        pdata[19] = nonces[0];
+        return(rc);
+    }
 
     *hashes_done = pdata[19] - first_nonce + 1;
     return(0);
@@ -0,0 +1,70 @@
+#include <string.h>
+
+#include "../neoscrypt.h"
+
+#include "miner.h"
+#include "log.h"
+
+/* Nonces hashed between work restart checks, a multiple of 16 lanes */
+#define NEOSCRYPT_CPU_BATCH 64
+
+static neoscrypt_arena arena[MAX_GPUS];
+
+/* CPU counterpart of scanhash_neoscrypt(); one call per miner thread,
+ * the nonce range and CPU affinity are set up by miner_thread() */
+extern "C" int scanhash_neoscrypt_cpu(int thr_id, uint *pdata, const uint *ptarget,
+  uint max_nonce, uint64_t *hashes_done, uint *nonces) {
+    const uint first_nonce = pdata[19];
+    uint hash[NEOSCRYPT_CPU_BATCH * 8];
+    neoscrypt_job job;
+    uint nonce, count, i;
+    int rc = 0;
+
+    if(opt_benchmark)
+      ((uint *) ptarget)[7] = 0x01FF;
+
+    static bool init[MAX_GPUS] = { 0 };
+
+    if(!init[thr_id]) {
+        if(neoscrypt_arena_init(&arena[thr_id],
+          opt_hugepages ? NEOSCRYPT_ARENA_HUGE : 0)) {
+            applog(LOG_ERR, "CPU #%d: unable to allocate scratch memory", thr_id);
+            *hashes_done = 0;
+            return(0);
+        }
+        if(opt_hugepages && !arena[thr_id].huge && !opt_quiet)
+          applog(LOG_INFO, "CPU #%d: no reserved huge pages, using normal memory", thr_id);
+        init[thr_id] = true;
+    }
+
+    /* Input data must be little endian already */
+
+    neoscrypt_job_init(&job, (uchar *) pdata);
+
+    nonce = first_nonce;
+
+    while(!work_restart[thr_id].restart && (nonce < max_nonce)) {
+
+        count = MIN(NEOSCRYPT_CPU_BATCH, max_nonce - nonce);
+
+        neoscrypt_job_multi(&job, nonce, (uchar *) hash, count, &arena[thr_id]);
+
+        for(i = 0; (i < count) && (rc < MAX_NONCES); i++) {
+            if((hash[i * 8 + 7] <= ptarget[7]) && fulltest(&hash[i * 8], ptarget))
+              nonces[rc++] = nonce + i;
+        }
+
+        nonce += count;
+
+        if(rc) {
+            pdata[19] = nonces[0];
+            *hashes_done = nonce - first_nonce;
+            return(rc);
+        }
+
+    }
+
+    pdata[19] = nonce;
+    *hashes_done = nonce - first_nonce;
+    return(0);
+}
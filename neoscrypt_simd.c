@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2014-2016 John Doering <ghostlander@phoenixcoin.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* Multi-lane NeoScrypt: 4, 8 or 16 independent hashes run side by side
+ * in SSE2, AVX2 or AVX-512 registers, one 32-bit lane per hash;
+ * both SMix and the BLAKE2s based FastKDF are vectorised */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cudaminer-config.h"
+#include "neoscrypt.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/* Every lane needs X, Z, V and the FastKDF buffers A, B, T */
+#define NEOSCRYPT_LANE_SCRATCH (130 * 256 + 320 + 288 + 256)
+
+#if defined(__x86_64__) || defined(__i386__) || \
+    defined(_M_X64) || defined(_M_IX86)
+#define NEOSCRYPT_X86
+#endif
+
+#ifdef NEOSCRYPT_X86
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NS_TARGET_SSE2
+#define NS_TARGET_AVX2
+#define NS_TARGET_AVX512
+#else
+#define NS_TARGET_SSE2   __attribute__((target("sse2")))
+#define NS_TARGET_AVX2   __attribute__((target("avx2")))
+#define NS_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#include <immintrin.h>
+
+/* Initialisation vector with a parameter block XOR'ed in */
+static const uint blake2s_IV_P_XOR[8] = {
+    0x6B08C647, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uchar blake2s_sigma[10][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 }
+};
+
+
+/* SSE2: 4 lanes */
+#define NS_ISA sse2
+#define NS_LANES 4
+#define NS_ROW_SHIFT 8
+#define NS_TARGET NS_TARGET_SSE2
+#define nsv __m128i
+#define NS_ADD(a, b)  _mm_add_epi32(a, b)
+#define NS_XOR(a, b)  _mm_xor_si128(a, b)
+#define NS_AND(a, b)  _mm_and_si128(a, b)
+#define NS_SLLI(a, n) _mm_slli_epi32(a, n)
+#define NS_SRLI(a, n) _mm_srli_epi32(a, n)
+#define NS_ROTL(a, n) _mm_or_si128(_mm_slli_epi32(a, n), _mm_srli_epi32(a, 32 - (n)))
+#define NS_SET1(x)    _mm_set1_epi32(x)
+#define NS_LOADU(p)   _mm_loadu_si128((const void *) (p))
+#define NS_LANEID     _mm_setr_epi32(0, 1, 2, 3)
+
+#include "neoscrypt_simd.h"
+
+#undef NS_ISA
+#undef NS_LANES
+#undef NS_ROW_SHIFT
+#undef NS_TARGET
+#undef nsv
+#undef NS_ADD
+#undef NS_XOR
+#undef NS_AND
+#undef NS_SLLI
+#undef NS_SRLI
+#undef NS_ROTL
+#undef NS_SET1
+#undef NS_LOADU
+#undef NS_LANEID
+
+
+#ifdef USE_AVX2
+/* AVX2: 8 lanes */
+#define NS_ISA avx2
+#define NS_LANES 8
+#define NS_ROW_SHIFT 9
+#define NS_TARGET NS_TARGET_AVX2
+#define nsv __m256i
+#define NS_ADD(a, b)  _mm256_add_epi32(a, b)
+#define NS_XOR(a, b)  _mm256_xor_si256(a, b)
+#define NS_AND(a, b)  _mm256_and_si256(a, b)
+#define NS_SLLI(a, n) _mm256_slli_epi32(a, n)
+#define NS_SRLI(a, n) _mm256_srli_epi32(a, n)
+#define NS_ROTL(a, n) _mm256_or_si256(_mm256_slli_epi32(a, n), _mm256_srli_epi32(a, 32 - (n)))
+#define NS_SET1(x)    _mm256_set1_epi32(x)
+#define NS_LOADU(p)   _mm256_loadu_si256((const void *) (p))
+#define NS_LANEID     _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)
+#define NS_GATHER(p, i, s) _mm256_i32gather_epi32(p, i, s)
+
+#include "neoscrypt_simd.h"
+
+#undef NS_ISA
+#undef NS_LANES
+#undef NS_ROW_SHIFT
+#undef NS_TARGET
+#undef nsv
+#undef NS_ADD
+#undef NS_XOR
+#undef NS_AND
+#undef NS_SLLI
+#undef NS_SRLI
+#undef NS_ROTL
+#undef NS_SET1
+#undef NS_LOADU
+#undef NS_LANEID
+#undef NS_GATHER
+#endif /* USE_AVX2 */
+
+
+#ifdef USE_AVX512
+/* AVX-512: 16 lanes */
+#define NS_ISA avx512
+#define NS_LANES 16
+#define NS_ROW_SHIFT 10
+#define NS_TARGET NS_TARGET_AVX512
+#define nsv __m512i
+#define NS_ADD(a, b)  _mm512_add_epi32(a, b)
+#define NS_XOR(a, b)  _mm512_xor_si512(a, b)
+#define NS_AND(a, b)  _mm512_and_si512(a, b)
+#define NS_SLLI(a, n) _mm512_slli_epi32(a, n)
+#define NS_SRLI(a, n) _mm512_srli_epi32(a, n)
+#define NS_ROTL(a, n) _mm512_rol_epi32(a, n)
+#define NS_SET1(x)    _mm512_set1_epi32(x)
+#define NS_LOADU(p)   _mm512_loadu_si512((const void *) (p))
+#define NS_LANEID     _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, \
+                        8, 9, 10, 11, 12, 13, 14, 15)
+#define NS_GATHER(p, i, s) _mm512_i32gather_epi32(i, p, s)
+
+#include "neoscrypt_simd.h"
+
+#undef NS_ISA
+#undef NS_LANES
+#undef NS_ROW_SHIFT
+#undef NS_TARGET
+#undef nsv
+#undef NS_ADD
+#undef NS_XOR
+#undef NS_AND
+#undef NS_SLLI
+#undef NS_SRLI
+#undef NS_ROTL
+#undef NS_SET1
+#undef NS_LOADU
+#undef NS_LANEID
+#undef NS_GATHER
+#endif /* USE_AVX512 */
+
+#endif /* NEOSCRYPT_X86 */
+
+
+/* Vector extensions usable by this CPU and operating system */
+uint neoscrypt_cpu_exts(void) {
+    static int exts = -1;
+    uint ret = 0;
+
+    if(exts >= 0)
+      return((uint) exts);
+
+#ifdef NEOSCRYPT_X86
+#ifdef _MSC_VER
+    {
+        int info[4];
+        unsigned long long xcr0 = 0;
+
+        __cpuid(info, 1);
+        if(info[3] & (1 << 26))
+          ret |= NEOSCRYPT_EXT_SSE2;
+        /* OSXSAVE and AVX */
+        if((info[2] & (1 << 27)) && (info[2] & (1 << 28)))
+          xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        if(((xcr0 & 0x06) == 0x06) && (info[1] & (1 << 5)))
+          ret |= NEOSCRYPT_EXT_AVX2;
+        if(((xcr0 & 0xE6) == 0xE6) && (info[1] & (1 << 16)))
+          ret |= NEOSCRYPT_EXT_AVX512;
+    }
+#else
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2"))
+      ret |= NEOSCRYPT_EXT_SSE2;
+#ifdef USE_AVX2
+    if(__builtin_cpu_supports("avx2"))
+      ret |= NEOSCRYPT_EXT_AVX2;
+#endif
+#ifdef USE_AVX512
+    if(__builtin_cpu_supports("avx512f"))
+      ret |= NEOSCRYPT_EXT_AVX512;
+#endif
+#endif /* _MSC_VER */
+#endif /* NEOSCRYPT_X86 */
+
+#ifndef USE_AVX2
+    ret &= ~NEOSCRYPT_EXT_AVX2;
+#endif
+#ifndef USE_AVX512
+    ret &= ~NEOSCRYPT_EXT_AVX512;
+#endif
+
+    exts = (int) ret;
+
+    return(ret);
+}
+
+/* Lane group width to use for left inputs, 0 for the scalar engine */
+static uint neoscrypt_lanes_width(uint exts, uint left) {
+
+#ifdef NEOSCRYPT_X86
+#ifdef USE_AVX512
+    if((exts & NEOSCRYPT_EXT_AVX512) && (left >= 16))
+      return(16);
+#endif
+#ifdef USE_AVX2
+    if((exts & NEOSCRYPT_EXT_AVX2) && (left >= 8))
+      return(8);
+#endif
+    if((exts & NEOSCRYPT_EXT_SSE2) && (left >= 4))
+      return(4);
+#endif
+
+    return(0);
+}
+
+/* Widest lane group the CPU can take, scratch is sized for it */
+static uint neoscrypt_lanes_max(uint exts) {
+
+    if(exts & NEOSCRYPT_EXT_AVX512)
+      return(16);
+    if(exts & NEOSCRYPT_EXT_AVX2)
+      return(8);
+    if(exts & NEOSCRYPT_EXT_SSE2)
+      return(4);
+
+    return(1);
+}
+
+/* FastKDF buffers of a lane group from width 80-byte passwords */
+static void neoscrypt_lanes_fill(uchar *scratch, uint width,
+  const uchar *password) {
+    uchar *A, *B, *a, *b;
+    uint l;
+
+    A = &scratch[130 * 256 * width];
+    B = &A[320 * width];
+
+    /* A is the same for both KDF passes; B = A for the 1st one */
+    for(l = 0; l < width; l++) {
+        a = &A[l * 320];
+        b = &B[l * 288];
+        neoscrypt_copy(&a[0],   &password[l * 80], 80);
+        neoscrypt_copy(&a[80],  &password[l * 80], 80);
+        neoscrypt_copy(&a[160], &password[l * 80], 80);
+        neoscrypt_copy(&a[240], &password[l * 80], 16);
+        neoscrypt_copy(&a[256], &password[l * 80], 64);
+        neoscrypt_copy(&b[0],   &a[0], 288);
+    }
+}
+
+/* FastKDF buffers of a lane group from a job and consecutive nonces */
+static void neoscrypt_lanes_fill_job(uchar *scratch, uint width,
+  const neoscrypt_job *job, uint nonce) {
+    uchar *A, *B;
+    uint l;
+
+    A = &scratch[130 * 256 * width];
+    B = &A[320 * width];
+
+    for(l = 0; l < width; l++)
+      neoscrypt_job_fill(job, nonce + l, &A[l * 320], &B[l * 288]);
+}
+
+/* Runs the engine of the given width over a filled lane group */
+static void neoscrypt_lanes_run(uint width, uchar *output, uchar *scratch,
+  uint first, uint start) {
+
+#ifdef NEOSCRYPT_X86
+    switch(width) {
+#ifdef USE_AVX512
+    case(16):
+        neoscrypt_lanes_avx512(output, scratch, first, start);
+        break;
+#endif
+#ifdef USE_AVX2
+    case(8):
+        neoscrypt_lanes_avx2(output, scratch, first, start);
+        break;
+#endif
+    case(4):
+        neoscrypt_lanes_sse2(output, scratch, first, start);
+        break;
+    }
+#endif
+}
+
+/* Huge page size assumed when rounding allocations up */
+#define NEOSCRYPT_HUGE_PAGE 0x200000
+
+/* Sets up a scratch arena sized for this CPU;
+ * huge pages are tried first if requested, then ordinary memory;
+ * returns 0 on success */
+int neoscrypt_arena_init(neoscrypt_arena *arena, uint flags) {
+    const size_t stack_align = 0x40;
+    size_t size, hsize;
+
+    size = NEOSCRYPT_LANE_SCRATCH * neoscrypt_lanes_max(neoscrypt_cpu_exts());
+    if(size < NEOSCRYPT_SCRATCH_SIZE)
+      size = NEOSCRYPT_SCRATCH_SIZE;
+    hsize = (size + NEOSCRYPT_HUGE_PAGE - 1) & ~((size_t)NEOSCRYPT_HUGE_PAGE - 1);
+
+    arena->base = arena->mem = NULL;
+    arena->size = 0;
+    arena->huge = 0;
+
+    if(flags & NEOSCRYPT_ARENA_HUGE) {
+#if defined(_WIN32)
+        /* Needs the lock pages in memory privilege */
+        size_t large = GetLargePageMinimum();
+        if(large) {
+            hsize = (size + large - 1) & ~(large - 1);
+            arena->base = (uchar *) VirtualAlloc(NULL, hsize,
+              MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        }
+#elif defined(__linux__) && defined(MAP_HUGETLB)
+        /* Reserved huge pages if the administrator has set any up */
+        arena->base = (uchar *) mmap(NULL, hsize, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(arena->base == (uchar *) MAP_FAILED)
+          arena->base = NULL;
+#endif
+        if(arena->base) {
+            arena->mem = arena->base;
+            arena->size = (unsigned long) hsize;
+            arena->huge = 1;
+            return(0);
+        }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        /* Transparent huge pages otherwise */
+        if(!posix_memalign((void **) &arena->base, NEOSCRYPT_HUGE_PAGE, hsize)) {
+            madvise(arena->base, hsize, MADV_HUGEPAGE);
+            arena->mem = arena->base;
+            arena->size = (unsigned long) hsize;
+            return(0);
+        }
+        arena->base = NULL;
+#endif
+    }
+
+    arena->base = (uchar *) malloc(size + stack_align);
+    if(!arena->base)
+      return(-1);
+    arena->mem = (uchar *) (((size_t)arena->base & ~(stack_align - 1)) + stack_align);
+    arena->size = (unsigned long) size;
+
+    return(0);
+}
+
+void neoscrypt_arena_free(neoscrypt_arena *arena) {
+
+    if(!arena->base)
+      return;
+
+    if(arena->huge) {
+#if defined(_WIN32)
+        VirtualFree(arena->base, 0, MEM_RELEASE);
+#elif defined(__linux__)
+        munmap(arena->base, arena->size);
+#endif
+    } else {
+        free(arena->base);
+    }
+
+    arena->base = arena->mem = NULL;
+    arena->size = 0;
+    arena->huge = 0;
+}
+
+void neoscrypt_multi(const uchar *password, uchar *output, uint lanes,
+  neoscrypt_arena *arena) {
+    neoscrypt_arena temp;
+    uint exts = neoscrypt_cpu_exts();
+    uint i, width;
+    uchar *scratch;
+
+    if(!arena) {
+        arena = &temp;
+        if(neoscrypt_arena_init(arena, 0)) {
+            for(i = 0; i < lanes; i++)
+              neoscrypt(&password[i * 80], &output[i * 32]);
+            return;
+        }
+    }
+    scratch = arena->mem;
+
+    for(i = 0; i < lanes; ) {
+        width = neoscrypt_lanes_width(exts, lanes - i);
+        if(width) {
+            neoscrypt_lanes_fill(scratch, width, &password[i * 80]);
+            neoscrypt_lanes_run(width, &output[i * 32], scratch, 0, 0);
+            i += width;
+        } else {
+            /* Remainder goes through the scalar engine */
+            neoscrypt_core(&password[i * 80], &output[i * 32], scratch);
+            i++;
+        }
+    }
+
+    if(arena == &temp)
+      neoscrypt_arena_free(arena);
+}
+
+void neoscrypt_job_multi(const neoscrypt_job *job, uint first_nonce,
+  uchar *output, uint count, neoscrypt_arena *arena) {
+    neoscrypt_arena temp;
+    uint exts = neoscrypt_cpu_exts();
+    uint i, width;
+    uchar *scratch;
+
+    if(!arena) {
+        arena = &temp;
+        if(neoscrypt_arena_init(arena, 0)) {
+            for(i = 0; i < count; i++)
+              neoscrypt_job_hash(job, first_nonce + i, &output[i * 32]);
+            return;
+        }
+    }
+    scratch = arena->mem;
+
+    for(i = 0; i < count; ) {
+        width = neoscrypt_lanes_width(exts, count - i);
+        if(width) {
+            neoscrypt_lanes_fill_job(scratch, width, job, first_nonce + i);
+            neoscrypt_lanes_run(width, &output[i * 32], scratch,
+              job->rounds, job->bufptr);
+            i += width;
+        } else {
+            neoscrypt_job_core(job, first_nonce + i, &output[i * 32], scratch);
+            i++;
+        }
+    }
+
+    if(arena == &temp)
+      neoscrypt_arena_free(arena);
+}
@@ -0,0 +1,372 @@
+/* NeoScrypt multi-lane engine template;
+ * included by neoscrypt_simd.c once per instruction set, so there is
+ * no include guard here on purpose.
+ *
+ * The including file defines:
+ *   NS_ISA          function name suffix (sse2, avx2, avx512);
+ *   NS_LANES        number of 32-bit lanes in a vector;
+ *   NS_ROW_SHIFT    log2(64 * NS_LANES), the V row stride in words;
+ *   NS_TARGET       function attribute enabling the instruction set;
+ *   nsv             vector type;
+ *   NS_ADD, NS_XOR, NS_AND, NS_SLLI, NS_SRLI, NS_ROTL, NS_SET1  primitives;
+ *   NS_LANEID       vector of lane numbers 0 to NS_LANES - 1;
+ *   NS_LOADU(p)     unaligned vector load;
+ *   NS_GATHER(p, i, s)  optional 32-bit gather of p + i * s for every lane.
+ *
+ * Lane layout: word w of lane l is ((uint *) X)[w * NS_LANES + l],
+ * i.e. every vector holds the same word of all lanes */
+
+#define NS_CAT_(a, b) a##_##b
+#define NS_CAT(a, b) NS_CAT_(a, b)
+#define NS_FN(name) NS_CAT(name, NS_ISA)
+
+/* Salsa20/20 on NS_LANES independent blocks */
+static NS_TARGET void NS_FN(neoscrypt_salsa)(nsv *X) {
+    nsv x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, t;
+    uint rounds;
+
+    x0 = X[0];   x1 = X[1];   x2 = X[2];   x3 = X[3];
+    x4 = X[4];   x5 = X[5];   x6 = X[6];   x7 = X[7];
+    x8 = X[8];   x9 = X[9];  x10 = X[10]; x11 = X[11];
+   x12 = X[12]; x13 = X[13]; x14 = X[14]; x15 = X[15];
+
+#define quarter(a, b, c, d) \
+    t = NS_ADD(a, d); t = NS_ROTL(t,  7); b = NS_XOR(b, t); \
+    t = NS_ADD(b, a); t = NS_ROTL(t,  9); c = NS_XOR(c, t); \
+    t = NS_ADD(c, b); t = NS_ROTL(t, 13); d = NS_XOR(d, t); \
+    t = NS_ADD(d, c); t = NS_ROTL(t, 18); a = NS_XOR(a, t);
+
+    for(rounds = 20; rounds; rounds -= 2) {
+        quarter( x0,  x4,  x8, x12);
+        quarter( x5,  x9, x13,  x1);
+        quarter(x10, x14,  x2,  x6);
+        quarter(x15,  x3,  x7, x11);
+        quarter( x0,  x1,  x2,  x3);
+        quarter( x5,  x6,  x7,  x4);
+        quarter(x10, x11,  x8,  x9);
+        quarter(x15, x12, x13, x14);
+    }
+
+    X[0]  = NS_ADD(X[0],  x0);  X[1]  = NS_ADD(X[1],  x1);
+    X[2]  = NS_ADD(X[2],  x2);  X[3]  = NS_ADD(X[3],  x3);
+    X[4]  = NS_ADD(X[4],  x4);  X[5]  = NS_ADD(X[5],  x5);
+    X[6]  = NS_ADD(X[6],  x6);  X[7]  = NS_ADD(X[7],  x7);
+    X[8]  = NS_ADD(X[8],  x8);  X[9]  = NS_ADD(X[9],  x9);
+    X[10] = NS_ADD(X[10], x10); X[11] = NS_ADD(X[11], x11);
+    X[12] = NS_ADD(X[12], x12); X[13] = NS_ADD(X[13], x13);
+    X[14] = NS_ADD(X[14], x14); X[15] = NS_ADD(X[15], x15);
+
+#undef quarter
+}
+
+/* ChaCha20/20 on NS_LANES independent blocks */
+static NS_TARGET void NS_FN(neoscrypt_chacha)(nsv *X) {
+    nsv x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, t;
+    uint rounds;
+
+    x0 = X[0];   x1 = X[1];   x2 = X[2];   x3 = X[3];
+    x4 = X[4];   x5 = X[5];   x6 = X[6];   x7 = X[7];
+    x8 = X[8];   x9 = X[9];  x10 = X[10]; x11 = X[11];
+   x12 = X[12]; x13 = X[13]; x14 = X[14]; x15 = X[15];
+
+#define quarter(a, b, c, d) \
+    a = NS_ADD(a, b); t = NS_XOR(d, a); d = NS_ROTL(t, 16); \
+    c = NS_ADD(c, d); t = NS_XOR(b, c); b = NS_ROTL(t, 12); \
+    a = NS_ADD(a, b); t = NS_XOR(d, a); d = NS_ROTL(t,  8); \
+    c = NS_ADD(c, d); t = NS_XOR(b, c); b = NS_ROTL(t,  7);
+
+    for(rounds = 20; rounds; rounds -= 2) {
+        quarter( x0,  x4,  x8, x12);
+        quarter( x1,  x5,  x9, x13);
+        quarter( x2,  x6, x10, x14);
+        quarter( x3,  x7, x11, x15);
+        quarter( x0,  x5, x10, x15);
+        quarter( x1,  x6, x11, x12);
+        quarter( x2,  x7,  x8, x13);
+        quarter( x3,  x4,  x9, x14);
+    }
+
+    X[0]  = NS_ADD(X[0],  x0);  X[1]  = NS_ADD(X[1],  x1);
+    X[2]  = NS_ADD(X[2],  x2);  X[3]  = NS_ADD(X[3],  x3);
+    X[4]  = NS_ADD(X[4],  x4);  X[5]  = NS_ADD(X[5],  x5);
+    X[6]  = NS_ADD(X[6],  x6);  X[7]  = NS_ADD(X[7],  x7);
+    X[8]  = NS_ADD(X[8],  x8);  X[9]  = NS_ADD(X[9],  x9);
+    X[10] = NS_ADD(X[10], x10); X[11] = NS_ADD(X[11], x11);
+    X[12] = NS_ADD(X[12], x12); X[13] = NS_ADD(X[13], x13);
+    X[14] = NS_ADD(X[14], x14); X[15] = NS_ADD(X[15], x15);
+
+#undef quarter
+}
+
+/* BLAKE2s compression of one 64-byte block in every lane;
+ * t is the byte counter and f the finalisation flag */
+static NS_TARGET void NS_FN(blake2s_compress)(nsv *h, const nsv *m,
+  uint t, uint f) {
+    nsv v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15;
+    uint r;
+
+    v0 = h[0]; v1 = h[1]; v2 = h[2]; v3 = h[3];
+    v4 = h[4]; v5 = h[5]; v6 = h[6]; v7 = h[7];
+    v8  = NS_SET1(0x6A09E667);
+    v9  = NS_SET1(0xBB67AE85);
+    v10 = NS_SET1(0x3C6EF372);
+    v11 = NS_SET1(0xA54FF53A);
+    v12 = NS_SET1(0x510E527F ^ t);
+    v13 = NS_SET1(0x9B05688C);
+    v14 = NS_SET1(0x1F83D9AB ^ f);
+    v15 = NS_SET1(0x5BE0CD19);
+
+#define G(i, a, b, c, d) \
+    a = NS_ADD(NS_ADD(a, b), m[blake2s_sigma[r][2 * i]]); \
+    d = NS_ROTL(NS_XOR(d, a), 16); \
+    c = NS_ADD(c, d); \
+    b = NS_ROTL(NS_XOR(b, c), 20); \
+    a = NS_ADD(NS_ADD(a, b), m[blake2s_sigma[r][2 * i + 1]]); \
+    d = NS_ROTL(NS_XOR(d, a), 24); \
+    c = NS_ADD(c, d); \
+    b = NS_ROTL(NS_XOR(b, c), 25);
+
+    for(r = 0; r < 10; r++) {
+        G(0, v0, v4,  v8, v12);
+        G(1, v1, v5,  v9, v13);
+        G(2, v2, v6, v10, v14);
+        G(3, v3, v7, v11, v15);
+        G(4, v0, v5, v10, v15);
+        G(5, v1, v6, v11, v12);
+        G(6, v2, v7,  v8, v13);
+        G(7, v3, v4,  v9, v14);
+    }
+
+#undef G
+
+    h[0] = NS_XOR(h[0], NS_XOR(v0, v8));
+    h[1] = NS_XOR(h[1], NS_XOR(v1, v9));
+    h[2] = NS_XOR(h[2], NS_XOR(v2, v10));
+    h[3] = NS_XOR(h[3], NS_XOR(v3, v11));
+    h[4] = NS_XOR(h[4], NS_XOR(v4, v12));
+    h[5] = NS_XOR(h[5], NS_XOR(v5, v13));
+    h[6] = NS_XOR(h[6], NS_XOR(v6, v14));
+    h[7] = NS_XOR(h[7], NS_XOR(v7, v15));
+}
+
+/* m[k] = 32-bit word k at buf + l * stride + bufptr[l] for every lane l */
+static NS_TARGET void NS_FN(neoscrypt_kdf_load)(nsv *m, const uchar *buf,
+  uint stride, const uint *bufptr, uint words) {
+#ifdef NS_GATHER
+    uint off[NS_LANES];
+    nsv idx;
+    uint k, l;
+
+    for(l = 0; l < NS_LANES; l++)
+      off[l] = l * stride + bufptr[l];
+    idx = NS_LOADU(off);
+
+    for(k = 0; k < words; k++)
+      m[k] = NS_GATHER((const int *) &buf[4 * k], idx, 1);
+#else
+    uint *w = (uint *) m;
+    const uchar *p;
+    uint k, l;
+
+    for(l = 0; l < NS_LANES; l++) {
+        p = &buf[l * stride + bufptr[l]];
+        for(k = 0; k < words; k++)
+          memcpy(&w[k * NS_LANES + l], &p[4 * k], 4);
+    }
+#endif
+}
+
+/* FastKDF-BLAKE2s of NS_LANES inputs, see neoscrypt_fastkdf_opt();
+ * A and B are NS_LANES buffers of 320 and 288 bytes prepared by
+ * the caller, B is consumed; every lane keeps its own bufptr
+ * starting at the same value from round first */
+static NS_TARGET void NS_FN(neoscrypt_fastkdf)(const uchar *A, uchar *B,
+  uchar *output, uint output_len, uint first, uint start) {
+    uint bufptr[NS_LANES], S[8];
+    nsv h[8], m[16], sum, t;
+    const uint *hw = (const uint *) h, *sw = (const uint *) &sum;
+    const uchar *a;
+    uchar *b, *o;
+    uint i, k, l, p;
+
+    for(l = 0; l < NS_LANES; l++)
+      bufptr[l] = start;
+
+    for(i = first; i < 32; i++) {
+
+        /* BLAKE2s: compress IV using key */
+        for(k = 0; k < 8; k++)
+          h[k] = NS_SET1(blake2s_IV_P_XOR[k]);
+        NS_FN(neoscrypt_kdf_load)(m, B, 288, bufptr, 8);
+        for(k = 8; k < 16; k++)
+          m[k] = NS_SET1(0);
+        NS_FN(blake2s_compress)(h, m, 64, 0);
+
+        /* BLAKE2s: compress again using input */
+        NS_FN(neoscrypt_kdf_load)(m, A, 320, bufptr, 16);
+        NS_FN(blake2s_compress)(h, m, 128, ~0U);
+
+        /* Byte sum of the digest in every lane */
+        sum = NS_SET1(0);
+        for(k = 0; k < 8; k++) {
+            t = NS_ADD(h[k], NS_SRLI(h[k], 8));
+            t = NS_ADD(t, NS_SRLI(h[k], 16));
+            sum = NS_ADD(sum, NS_ADD(t, NS_SRLI(h[k], 24)));
+        }
+
+        for(l = 0; l < NS_LANES; l++) {
+            p = bufptr[l] = sw[l] & 0xFF;
+            b = &B[l * 288];
+
+            for(k = 0; k < 8; k++)
+              S[k] = hw[k * NS_LANES + l];
+            neoscrypt_xor(&b[p], S, 32);
+
+            if(p < 32)
+              neoscrypt_copy(&b[256 + p], &b[p], 32 - p);
+            else if(p > 224)
+              neoscrypt_copy(&b[0], &b[256], p - 224);
+        }
+
+    }
+
+    for(l = 0; l < NS_LANES; l++) {
+        a = &A[l * 320];
+        b = &B[l * 288];
+        o = &output[l * output_len];
+        p = bufptr[l];
+        for(k = 0; k < output_len; k++)
+          o[k] = b[(p + k) & 0xFF] ^ a[k];
+    }
+}
+
+/* Block XOR of 16 vectors */
+static NS_TARGET void NS_FN(neoscrypt_blkxor)(nsv *dst, const nsv *src) {
+    uint i;
+
+    for(i = 0; i < 16; i++)
+      dst[i] = NS_XOR(dst[i], src[i]);
+}
+
+/* NeoScrypt block mixer for r = 2, see neoscrypt_blkmix() */
+static NS_TARGET void NS_FN(neoscrypt_blkmix)(nsv *X, uint mixer) {
+    nsv t;
+    uint i;
+
+    if(mixer) {
+        NS_FN(neoscrypt_blkxor)(&X[0], &X[48]);
+        NS_FN(neoscrypt_chacha)(&X[0]);
+        NS_FN(neoscrypt_blkxor)(&X[16], &X[0]);
+        NS_FN(neoscrypt_chacha)(&X[16]);
+        NS_FN(neoscrypt_blkxor)(&X[32], &X[16]);
+        NS_FN(neoscrypt_chacha)(&X[32]);
+        NS_FN(neoscrypt_blkxor)(&X[48], &X[32]);
+        NS_FN(neoscrypt_chacha)(&X[48]);
+    } else {
+        NS_FN(neoscrypt_blkxor)(&X[0], &X[48]);
+        NS_FN(neoscrypt_salsa)(&X[0]);
+        NS_FN(neoscrypt_blkxor)(&X[16], &X[0]);
+        NS_FN(neoscrypt_salsa)(&X[16]);
+        NS_FN(neoscrypt_blkxor)(&X[32], &X[16]);
+        NS_FN(neoscrypt_salsa)(&X[32]);
+        NS_FN(neoscrypt_blkxor)(&X[48], &X[32]);
+        NS_FN(neoscrypt_salsa)(&X[48]);
+    }
+
+    for(i = 16; i < 32; i++) {
+        t = X[i];
+        X[i] = X[i + 16];
+        X[i + 16] = t;
+    }
+}
+
+/* X ^= V[integerify(X) mod N] with an independent row for every lane */
+static NS_TARGET void NS_FN(neoscrypt_rowxor)(nsv *X, const nsv *V) {
+#ifdef NS_GATHER
+    nsv idx;
+    uint k;
+
+    /* Word offset of the row selected by every lane */
+    idx = NS_AND(X[48], NS_SET1(127));
+    idx = NS_ADD(NS_SLLI(idx, NS_ROW_SHIFT), NS_LANEID);
+
+    for(k = 0; k < 64; k++)
+      X[k] = NS_XOR(X[k], NS_GATHER((const int *) &V[k], idx, 4));
+#else
+    uint *x = (uint *) X;
+    const uint *v = (const uint *) V;
+    uint j, k, l;
+
+    for(l = 0; l < NS_LANES; l++) {
+        j = ((x[48 * NS_LANES + l] & 127) << NS_ROW_SHIFT) + l;
+        for(k = 0; k < 64; k++)
+          x[k * NS_LANES + l] ^= v[j + k * NS_LANES];
+    }
+#endif
+}
+
+/* SMix for N = 128, r = 2 */
+static NS_TARGET void NS_FN(neoscrypt_smix)(nsv *X, nsv *V, uint mixer) {
+    uint i, k;
+
+    for(i = 0; i < 128; i++) {
+        for(k = 0; k < 64; k++)
+          V[i * 64 + k] = X[k];
+        NS_FN(neoscrypt_blkmix)(X, mixer);
+    }
+
+    for(i = 0; i < 128; i++) {
+        NS_FN(neoscrypt_rowxor)(X, V);
+        NS_FN(neoscrypt_blkmix)(X, mixer);
+    }
+}
+
+/* NeoScrypt of NS_LANES inputs; scratch must be 64-byte aligned and
+ * hold NEOSCRYPT_LANE_SCRATCH * NS_LANES bytes with the FastKDF
+ * buffers A and B of every lane set up already (see neoscrypt_lanes_fill());
+ * the 1st FastKDF resumes from round first at bufptr start */
+static NS_TARGET void NS_FN(neoscrypt_lanes)(uchar *output, uchar *scratch,
+  uint first, uint start) {
+    nsv *X, *Z, *V;
+    uchar *A, *B, *b;
+    uint *x, *T;
+    uint k, l;
+
+    X = (nsv *) scratch;
+    Z = &X[64];
+    V = &X[128];
+    x = (uint *) X;
+    /* FastKDF buffers of every lane follow V */
+    A = &scratch[130 * 256 * NS_LANES];
+    B = &A[320 * NS_LANES];
+    T = (uint *) &B[288 * NS_LANES];
+
+    /* X = KDF(password, salt) for every lane, transposed */
+    NS_FN(neoscrypt_fastkdf)(A, B, (uchar *) T, 256, first, start);
+    for(l = 0; l < NS_LANES; l++)
+      for(k = 0; k < 64; k++)
+        x[k * NS_LANES + l] = T[l * 64 + k];
+
+    for(k = 0; k < 64; k++)
+      Z[k] = X[k];
+
+    /* Z = SMix(Z) with ChaCha, X = SMix(X) with Salsa */
+    NS_FN(neoscrypt_smix)(Z, V, 1);
+    NS_FN(neoscrypt_smix)(X, V, 0);
+
+    for(k = 0; k < 64; k++)
+      X[k] = NS_XOR(X[k], Z[k]);
+
+    /* output = KDF(password, X) for every lane; A is unchanged */
+    for(l = 0; l < NS_LANES; l++) {
+        b = &B[l * 288];
+        for(k = 0; k < 64; k++)
+          ((uint *) b)[k] = x[k * NS_LANES + l];
+        neoscrypt_copy(&b[256], &b[0], 32);
+    }
+    NS_FN(neoscrypt_fastkdf)(A, B, output, 32, 0, 0);
+}
+
+#undef NS_FN
+#undef NS_CAT
+#undef NS_CAT_
@@ -0,0 +1,378 @@
+/**
+ * Non-blocking socket I/O for the network thread: a lock-free queue of
+ * lines to send and a wait on several sockets at once
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "cudaminer-config.h"
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#if defined(HAVE_SYS_EPOLL_H)
+#include <sys/epoll.h>
+#define NET_EPOLL
+#endif
+#if defined(HAVE_SYS_EVENTFD_H)
+#include <sys/eventfd.h>
+#define NET_EVENTFD
+#endif
+#endif
+
+#include "netloop.h"
+
+#ifdef _MSC_VER
+#define net_cas(p, o, n) (InterlockedCompareExchangePointer((PVOID volatile *) (p), (n), (o)) == (o))
+#define net_xchg(p, n) ((struct net_msg *) InterlockedExchangePointer((PVOID volatile *) (p), (n)))
+#else
+#define net_cas(p, o, n) __sync_bool_compare_and_swap((p), (o), (n))
+#define net_xchg(p, n) __sync_lock_test_and_set((p), (n))
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define NET_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define NET_SEND_FLAGS 0
+#endif
+
+bool net_would_block(void)
+{
+#ifdef WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+uint64_t net_time_ms(void)
+{
+#ifdef WIN32
+	return (uint64_t) GetTickCount64();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+bool net_set_nonblocking(curl_socket_t sock)
+{
+#ifdef WIN32
+	u_long on = 1;
+
+	return ioctlsocket(sock, FIONBIO, &on) == 0;
+#else
+	int flags = fcntl(sock, F_GETFL, 0);
+
+	return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+/* Queues s and a newline; false if out of memory */
+bool net_queue_push(struct net_queue *q, const char *s)
+{
+	size_t len = strlen(s);
+	struct net_msg *m;
+
+	m = (struct net_msg *) malloc(sizeof(struct net_msg) + len);
+	if (!m)
+		return false;
+	memcpy(m->data, s, len);
+	m->data[len] = '\n';
+	m->len = len + 1;
+	m->sent = 0;
+
+	do {
+		m->next = q->head;
+	} while (!net_cas(&q->head, m->next, m));
+
+	return true;
+}
+
+/* Moves everything pushed so far behind the pending messages,
+ * reversed into the order it was pushed in */
+static void net_queue_take(struct net_queue *q)
+{
+	struct net_msg *list, *m, *first = NULL, *last;
+
+	list = net_xchg(&q->head, (struct net_msg *) NULL);
+	if (!list)
+		return;
+
+	last = list;
+	while (list) {
+		m = list;
+		list = m->next;
+		m->next = first;
+		first = m;
+	}
+
+	if (q->pending)
+		q->pending_tail->next = first;
+	else
+		q->pending = first;
+	q->pending_tail = last;
+}
+
+/* Sends as much as the socket takes; a partly sent message is resumed
+ * on the next call; false on a socket error */
+bool net_queue_flush(struct net_queue *q, curl_socket_t sock)
+{
+	struct net_msg *m;
+	long n;
+
+	net_queue_take(q);
+
+	while ((m = q->pending)) {
+		n = (long) send(sock, m->data + m->sent, (int) (m->len - m->sent), NET_SEND_FLAGS);
+		if (n < 0)
+			return net_would_block();
+		m->sent += n;
+		if (m->sent < m->len)
+			return true;
+		q->pending = m->next;
+		free(m);
+	}
+
+	return true;
+}
+
+/* Something left to send, only valid on the network thread */
+bool net_queue_busy(struct net_queue *q)
+{
+	net_queue_take(q);
+	return q->pending != NULL;
+}
+
+/* Drops whatever was not sent, only on the network thread */
+void net_queue_clear(struct net_queue *q)
+{
+	struct net_msg *m;
+
+	net_queue_take(q);
+	while ((m = q->pending)) {
+		q->pending = m->next;
+		free(m);
+	}
+}
+
+bool net_loop_init(struct net_loop *loop)
+{
+	memset(loop, 0, sizeof(*loop));
+	loop->fd = -1;
+	loop->wake_fd[0] = loop->wake_fd[1] = -1;
+
+#ifdef NET_EPOLL
+	loop->fd = epoll_create(NET_MAX_SOCKS + 1);
+	if (loop->fd < 0)
+		return false;
+#endif
+#if defined(NET_EVENTFD)
+	loop->wake_fd[0] = loop->wake_fd[1] = eventfd(0, EFD_NONBLOCK);
+	if (loop->wake_fd[0] < 0)
+		return false;
+#elif !defined(WIN32)
+	if (pipe(loop->wake_fd))
+		return false;
+	fcntl(loop->wake_fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(loop->wake_fd[1], F_SETFL, O_NONBLOCK);
+#endif
+#ifdef NET_EPOLL
+	{
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = loop->wake_fd[0];
+		if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, loop->wake_fd[0], &ev))
+			return false;
+	}
+#endif
+	return true;
+}
+
+void net_loop_free(struct net_loop *loop)
+{
+#ifndef WIN32
+	if (loop->wake_fd[0] >= 0)
+		close(loop->wake_fd[0]);
+	if (loop->wake_fd[1] >= 0 && loop->wake_fd[1] != loop->wake_fd[0])
+		close(loop->wake_fd[1]);
+#endif
+#ifdef NET_EPOLL
+	if (loop->fd >= 0)
+		close(loop->fd);
+#endif
+	loop->fd = -1;
+	loop->wake_fd[0] = loop->wake_fd[1] = -1;
+	loop->count = 0;
+}
+
+/* Adds sock or changes the events it is waited for */
+bool net_loop_watch(struct net_loop *loop, curl_socket_t sock, unsigned int events)
+{
+	int i;
+
+	for (i = 0; i < loop->count; i++)
+		if (loop->socks[i] == sock)
+			break;
+	if (i == NET_MAX_SOCKS)
+		return false;
+
+#ifdef NET_EPOLL
+	{
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = ((events & NET_READ) ? (uint32_t) EPOLLIN : 0) |
+			((events & NET_WRITE) ? (uint32_t) EPOLLOUT : 0);
+		ev.data.fd = sock;
+		if (epoll_ctl(loop->fd, i < loop->count ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, sock, &ev))
+			return false;
+	}
+#endif
+
+	loop->socks[i] = sock;
+	loop->events[i] = events;
+	if (i == loop->count)
+		loop->count++;
+	return true;
+}
+
+void net_loop_unwatch(struct net_loop *loop, curl_socket_t sock)
+{
+	int i;
+
+	for (i = 0; i < loop->count; i++) {
+		if (loop->socks[i] == sock) {
+#ifdef NET_EPOLL
+			struct epoll_event ev;
+			epoll_ctl(loop->fd, EPOLL_CTL_DEL, sock, &ev);
+#endif
+			loop->count--;
+			loop->socks[i] = loop->socks[loop->count];
+			loop->events[i] = loop->events[loop->count];
+			return;
+		}
+	}
+}
+
+/* Interrupts net_loop_wait(), from any thread */
+void net_loop_wake(struct net_loop *loop)
+{
+	loop->woken = 1;
+#if defined(NET_EVENTFD)
+	{
+		uint64_t one = 1;
+		if (write(loop->wake_fd[1], &one, sizeof(one)) < 0) {}
+	}
+#elif !defined(WIN32)
+	if (write(loop->wake_fd[1], "", 1) < 0) {}
+#endif
+}
+
+static void net_loop_drain(struct net_loop *loop)
+{
+#ifndef WIN32
+	char buf[64];
+
+	while (read(loop->wake_fd[0], buf, sizeof(buf)) > 0);
+#endif
+	loop->woken = 0;
+}
+
+/* Waits up to timeout_ms for the watched sockets or a wake up; returns
+ * the number of ready sockets stored to socks[] and events[], 0 on a
+ * timeout or a wake up, -1 on an error */
+int net_loop_wait(struct net_loop *loop, int timeout_ms,
+	curl_socket_t *socks, unsigned int *events, int max)
+{
+	int i, n = 0;
+
+	if (loop->woken) {
+		net_loop_drain(loop);
+		timeout_ms = 0;
+	}
+
+#ifdef NET_EPOLL
+	{
+		struct epoll_event ev[NET_MAX_SOCKS + 1];
+		int ready;
+
+		ready = epoll_wait(loop->fd, ev, NET_MAX_SOCKS + 1, timeout_ms);
+		if (ready < 0)
+			return errno == EINTR ? 0 : -1;
+		for (i = 0; i < ready; i++) {
+			if (ev[i].data.fd == loop->wake_fd[0]) {
+				net_loop_drain(loop);
+				continue;
+			}
+			if (n == max)
+				continue;
+			socks[n] = ev[i].data.fd;
+			events[n] = 0;
+			/* errors and hang ups show up on the next recv() or send() */
+			if (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				events[n] |= NET_READ;
+			if (ev[i].events & EPOLLOUT)
+				events[n] |= NET_WRITE;
+			n++;
+		}
+	}
+#else
+	{
+		struct timeval tv;
+		fd_set rd, wr;
+		int ready, top = -1;
+
+		FD_ZERO(&rd);
+		FD_ZERO(&wr);
+		for (i = 0; i < loop->count; i++) {
+			if (loop->events[i] & NET_READ)
+				FD_SET(loop->socks[i], &rd);
+			if (loop->events[i] & NET_WRITE)
+				FD_SET(loop->socks[i], &wr);
+			if ((int) loop->socks[i] > top)
+				top = (int) loop->socks[i];
+		}
+#ifdef WIN32
+		/* no wake up descriptor, poll the flag instead */
+		if (timeout_ms > 100)
+			timeout_ms = 100;
+#else
+		FD_SET(loop->wake_fd[0], &rd);
+		if (loop->wake_fd[0] > top)
+			top = loop->wake_fd[0];
+#endif
+		tv.tv_sec = timeout_ms / 1000;
+		tv.tv_usec = (timeout_ms % 1000) * 1000;
+		ready = select(top + 1, &rd, &wr, NULL, &tv);
+		if (ready < 0)
+			return errno == EINTR ? 0 : -1;
+#ifndef WIN32
+		if (FD_ISSET(loop->wake_fd[0], &rd))
+			net_loop_drain(loop);
+#else
+		if (loop->woken)
+			net_loop_drain(loop);
+#endif
+		for (i = 0; i < loop->count && n < max; i++) {
+			events[n] = (FD_ISSET(loop->socks[i], &rd) ? NET_READ : 0) |
+				(FD_ISSET(loop->socks[i], &wr) ? NET_WRITE : 0);
+			if (events[n])
+				socks[n++] = loop->socks[i];
+		}
+	}
+#endif
+
+	return n;
+}
@@ -0,0 +1,68 @@
+#ifndef NETLOOP_H
+#define NETLOOP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <curl/curl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Lines waiting to be sent on a socket: any thread pushes without taking
+ * a lock, only the network thread takes them off, oldest first */
+struct net_msg {
+	struct net_msg *next;
+	size_t len;
+	size_t sent;
+	char data[1];
+};
+
+struct net_queue {
+	struct net_msg *volatile head;	/* pushed, newest first */
+	struct net_msg *pending;	/* taken, oldest first */
+	struct net_msg *pending_tail;
+};
+
+bool net_queue_push(struct net_queue *q, const char *s);
+bool net_queue_flush(struct net_queue *q, curl_socket_t sock);
+bool net_queue_busy(struct net_queue *q);
+void net_queue_clear(struct net_queue *q);
+
+/* Socket readiness reported by net_loop_wait() */
+#define NET_READ  0x01
+#define NET_WRITE 0x02
+
+#define NET_MAX_SOCKS 8
+
+/* Waits on non-blocking sockets with epoll where available, select()
+ * elsewhere; net_loop_wake() interrupts a wait from another thread.
+ * Each stratum thread runs its own loop for its pool connection once
+ * the handshake is done; longpoll, getwork and the API server keep
+ * their own blocking sockets */
+struct net_loop {
+	int fd;
+	int wake_fd[2];
+	volatile int woken;
+	int count;
+	curl_socket_t socks[NET_MAX_SOCKS];
+	unsigned int events[NET_MAX_SOCKS];
+};
+
+bool net_loop_init(struct net_loop *loop);
+void net_loop_free(struct net_loop *loop);
+bool net_loop_watch(struct net_loop *loop, curl_socket_t sock, unsigned int events);
+void net_loop_unwatch(struct net_loop *loop, curl_socket_t sock);
+int  net_loop_wait(struct net_loop *loop, int timeout_ms,
+	curl_socket_t *socks, unsigned int *events, int max);
+void net_loop_wake(struct net_loop *loop);
+
+bool net_set_nonblocking(curl_socket_t sock);
+bool net_would_block(void);
+uint64_t net_time_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
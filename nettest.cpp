@@ -0,0 +1,282 @@
+/**
+ * "make check" test of the network loop against a stand-in stratum pool
+ *
+ * The pool runs on a loopback socket in its own thread. It reads with
+ * an injected delay through a small receive buffer, so the client's
+ * sends come back short or would block and net_queue_flush() has to
+ * resume them, and it answers every submit in small fragments. Miner
+ * like threads push submits through the lock-free queue and wake the
+ * loop, which has to deliver every line intact and in the order each
+ * thread pushed it, and match every answer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cudaminer-config.h"
+
+#ifdef WIN32
+int main(void)
+{
+	/* the stand-in pool uses POSIX sockets */
+	return 77;
+}
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "netloop.h"
+
+#define PUSHERS 4
+#define LINES   50	/* per pusher */
+#define PAD     2000	/* bytes of padding per submit */
+/* pool side injected delays, in microseconds */
+#define POOL_READ_DELAY  200
+#define POOL_WRITE_DELAY 50
+#define POOL_FRAGMENT    7
+
+#define ID(t, i) ((t) * 1000 + (i))
+
+static struct net_loop loop;
+static struct net_queue sendq;
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { \
+	fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+	fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); failures++; } } while (0)
+
+static void send_all(int fd, const char *s, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, s, len, MSG_NOSIGNAL);
+		if (n <= 0)
+			return;
+		s += n;
+		len -= n;
+	}
+}
+
+/* Checks a submit line and answers it in fragments; returns its id */
+static int pool_line(int fd, char *line)
+{
+	char answer[64], *pad;
+	int id = -1, i, len;
+
+	pad = strstr(line, "\"pad\": \"");
+	if (sscanf(line, "{\"id\":%d,", &id) != 1 || !pad) {
+		CHECK(0, "pool got a broken line: %.60s", line);
+		return -1;
+	}
+	pad += 8;
+	for (i = 0; i < PAD && pad[i] == 'a' + (id + i) % 26; i++);
+	CHECK(i == PAD && pad[PAD] == '"', "pool got submit %d damaged at byte %d", id, i);
+
+	len = snprintf(answer, sizeof(answer), "{\"id\":%d,\"result\":true,\"error\":null}\n", id);
+	for (i = 0; i < len; i += POOL_FRAGMENT) {
+		send_all(fd, answer + i, (len - i) < POOL_FRAGMENT ? len - i : POOL_FRAGMENT);
+		usleep(POOL_WRITE_DELAY);
+	}
+	return id;
+}
+
+static void *pool_thread(void *arg)
+{
+	int lsock = *(int *) arg, fd, n, got = 0, last[PUSHERS], id, t;
+	size_t head = 0, tail = 0, cap = 2 * (PAD + 256);
+	char *buf = (char *) malloc(cap), *nl;
+
+	for (t = 0; t < PUSHERS; t++)
+		last[t] = -1;
+
+	fd = accept(lsock, NULL, NULL);
+	if (fd < 0 || !buf) {
+		CHECK(0, "pool accept failed");
+		free(buf);
+		return NULL;
+	}
+
+	while (got < PUSHERS * LINES) {
+		usleep(POOL_READ_DELAY);
+		if (tail == cap) {
+			memmove(buf, buf + head, tail - head);
+			tail -= head;
+			head = 0;
+		}
+		/* small reads, the client has to wait for room */
+		n = (int) recv(fd, buf + tail, (cap - tail) < 512 ? cap - tail : 512, 0);
+		if (n <= 0)
+			break;
+		tail += n;
+		while ((nl = (char *) memchr(buf + head, '\n', tail - head))) {
+			*nl = '\0';
+			id = pool_line(fd, buf + head);
+			head = nl + 1 - buf;
+			if (id < 0)
+				continue;
+			t = id / 1000;
+			CHECK(t < PUSHERS && id % 1000 > last[t], "pool got submit %d out of order", id);
+			if (t < PUSHERS)
+				last[t] = id % 1000;
+			got++;
+		}
+	}
+	CHECK(got == PUSHERS * LINES, "pool got %d of %d submits", got, PUSHERS * LINES);
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+/* Pushes submits like miner threads, waking the loop every time */
+static void *pusher_thread(void *arg)
+{
+	int t = (int) (long) arg, i, k, len;
+	char *s = (char *) malloc(PAD + 128);
+
+	for (i = 0; s && i < LINES; i++) {
+		len = sprintf(s, "{\"id\":%d, \"method\": \"mining.submit\", \"pad\": \"", ID(t, i));
+		for (k = 0; k < PAD; k++)
+			s[len + k] = 'a' + (ID(t, i) + k) % 26;
+		strcpy(s + len + PAD, "\"}");
+		CHECK(net_queue_push(&sendq, s), "push of submit %d failed", ID(t, i));
+		net_loop_wake(&loop);
+		if (!(i % 8))
+			usleep(1000);
+	}
+	free(s);
+	return NULL;
+}
+
+static void test_wake(void)
+{
+	curl_socket_t socks[NET_MAX_SOCKS];
+	unsigned int events[NET_MAX_SOCKS];
+	uint64_t t;
+	int n;
+
+	/* a wake up ends a long wait at once */
+	net_loop_wake(&loop);
+	net_loop_wake(&loop);
+	t = net_time_ms();
+	n = net_loop_wait(&loop, 5000, socks, events, NET_MAX_SOCKS);
+	CHECK(n == 0 && net_time_ms() - t < 1000, "wake up not seen (%d, %u ms)",
+		n, (uint32_t) (net_time_ms() - t));
+
+	/* both were drained, the next wait runs to its timeout */
+	t = net_time_ms();
+	n = net_loop_wait(&loop, 200, socks, events, NET_MAX_SOCKS);
+	t = net_time_ms() - t;
+	CHECK(n == 0 && t >= 150, "wake up not drained (%d, %u ms)", n, (uint32_t) t);
+}
+
+int main(void)
+{
+	curl_socket_t socks[NET_MAX_SOCKS];
+	unsigned int events[NET_MAX_SOCKS];
+	struct sockaddr_in addr;
+	socklen_t alen = sizeof(addr);
+	pthread_t pool, pushers[PUSHERS];
+	int lsock, sock, small = 4096, answered[PUSHERS * 1000] = { 0 };
+	int resumed = 0, total = 0, n, i, t, id;
+	char rbuf[4096];
+	size_t rlen = 0;
+	uint64_t deadline;
+
+	signal(SIGPIPE, SIG_IGN);
+	alarm(60);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	lsock = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(lsock, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+	if (lsock < 0 || bind(lsock, (struct sockaddr *) &addr, sizeof(addr)) ||
+	    listen(lsock, 1) || getsockname(lsock, (struct sockaddr *) &addr, &alen)) {
+		fprintf(stderr, "no loopback socket, skipped\n");
+		return 77;
+	}
+	pthread_create(&pool, NULL, pool_thread, &lsock);
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+	if (sock < 0 || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) ||
+	    !net_set_nonblocking(sock)) {
+		fprintf(stderr, "FAIL: connect to the stand-in pool\n");
+		return 1;
+	}
+
+	CHECK(net_loop_init(&loop), "net_loop_init failed");
+	test_wake();
+
+	for (t = 0; t < PUSHERS; t++)
+		pthread_create(&pushers[t], NULL, pusher_thread, (void *) (long) t);
+
+	/* the loop of stratum_thread(): flush, watch, wait, read */
+	deadline = net_time_ms() + 30000;
+	while (total < PUSHERS * LINES && net_time_ms() < deadline) {
+		if (!net_queue_flush(&sendq, sock)) {
+			CHECK(0, "net_queue_flush failed");
+			break;
+		}
+		if (sendq.pending && sendq.pending->sent)
+			resumed++;
+		net_loop_watch(&loop, sock, NET_READ | (net_queue_busy(&sendq) ? NET_WRITE : 0));
+
+		n = net_loop_wait(&loop, 1000, socks, events, NET_MAX_SOCKS);
+		CHECK(n >= 0, "net_loop_wait failed");
+		for (i = 0; i < n; i++) {
+			ssize_t r;
+			char *line, *nl;
+
+			if (socks[i] != sock || !(events[i] & NET_READ))
+				continue;
+			r = recv(sock, rbuf + rlen, sizeof(rbuf) - rlen, 0);
+			if (r <= 0) {
+				CHECK(r < 0 && net_would_block(), "the pool closed early");
+				if (!net_would_block())
+					deadline = 0;
+				continue;
+			}
+			rlen += r;
+			line = rbuf;
+			while ((nl = (char *) memchr(line, '\n', rlen - (line - rbuf)))) {
+				*nl = '\0';
+				if (sscanf(line, "{\"id\":%d,", &id) == 1 && id >= 0 && id < PUSHERS * 1000) {
+					answered[id]++;
+					total++;
+				} else
+					CHECK(0, "broken answer: %s", line);
+				line = nl + 1;
+			}
+			rlen -= line - rbuf;
+			memmove(rbuf, line, rlen);
+		}
+	}
+
+	for (t = 0; t < PUSHERS; t++)
+		pthread_join(pushers[t], NULL);
+	pthread_join(pool, NULL);
+
+	for (t = 0; t < PUSHERS; t++)
+		for (i = 0; i < LINES; i++)
+			CHECK(answered[ID(t, i)] == 1, "submit %d answered %d times",
+				ID(t, i), answered[ID(t, i)]);
+	CHECK(resumed > 0, "no partly sent line was resumed");
+	CHECK(!net_queue_busy(&sendq), "lines left in the queue");
+
+	net_queue_clear(&sendq);
+	net_loop_free(&loop);
+	close(sock);
+	close(lsock);
+
+	printf("%d submits answered, %d partial sends resumed\n", total, resumed);
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures ? 1 : 0;
+}
+#endif /* WIN32 */
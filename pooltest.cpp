@@ -0,0 +1,349 @@
+/**
+ * "make check" test of the pool failover against two fake pools
+ *
+ * Both pools stay quiet after the first job and answer the keepalive
+ * probes with an error, as pools without mining.ping do; that alone
+ * must not fail over. Then the first one hangs with the connection
+ * open, the miner has to move to the backup within the probe timeouts,
+ * and come back once the first one answers again. Each connection runs
+ * through stratum_loop_step() and switches the pool mined on with
+ * stratum_switch() after every line, as stratum_thread() and
+ * stratum_check_job() do in the miner; the failover times are printed.
+ * -D logs the stratum traffic.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "miner.h"
+#include "log.h"
+
+#ifdef WIN32
+int main(void)
+{
+	/* the fake pools use POSIX sockets */
+	return 77;
+}
+#else
+#include <unistd.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+
+/* Silence before a probe and time to answer it, in ms */
+#define PROBE_MS 300
+/* Allowed on top of a failover's two probe timeouts */
+#define SLACK_MS 300
+
+/* The miner globals util.cpp uses, see cudaminer.cpp */
+bool opt_debug = false;
+bool opt_quiet = true;
+bool opt_protocol = false;
+int opt_timeout = 10;
+bool have_longpoll = false;
+bool want_stratum = true;
+bool have_stratum = true;
+char *opt_cert = NULL;
+char *opt_proxy = NULL;
+long opt_proxy_type = 0;
+struct thr_info *thr_info = NULL;
+int longpoll_thr_id = -1;
+int stratum_thr_id = -1;
+uint64_t global_hashrate = 0;
+double global_diff = 0.;
+
+/* Only reached by hash_selftest(), which needs the GPU code */
+void neoscrypt_blake2s_host(const uint32_t *input, const uint32_t *key, uint32_t *output)
+{
+	abort();
+}
+
+void applog(int prio, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (prio > LOG_WARNING && !opt_debug)
+		return;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+struct fake_pool {
+	int lsock;
+	int port;
+	volatile bool hang;	/* connection kept, nothing read or sent */
+	volatile int pings;	/* probes answered */
+};
+
+static struct fake_pool fakes[2];
+static struct stratum_ctx pools[2];
+static volatile bool done = false;
+
+/* The pool mined on, stratum in the miner, and g_work_lock */
+static struct stratum_ctx *mining = &pools[0];
+static pthread_mutex_t mining_lock = PTHREAD_MUTEX_INITIALIZER;
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { \
+	fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+	fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); failures++; } } while (0)
+
+static void fake_send(int fd, const char *s)
+{
+	send(fd, s, strlen(s), MSG_NOSIGNAL);
+}
+
+static void fake_line(struct fake_pool *fp, int fd, const char *line)
+{
+	char s[128];
+	int id = 0;
+
+	sscanf(line, "{\"id\": %d,", &id);
+	if (strstr(line, "\"mining.subscribe\"")) {
+		fake_send(fd, "{\"id\":1,\"result\":[[[\"mining.notify\",\"ae68\"]],\"08000002\",4],\"error\":null}\n");
+	} else if (strstr(line, "\"mining.authorize\"")) {
+		fake_send(fd, "{\"id\":2,\"result\":true,\"error\":null}\n");
+		fake_send(fd, "{\"id\":null,\"method\":\"mining.set_difficulty\",\"params\":[1]}\n");
+		/* one job, then nothing unless asked */
+		fake_send(fd, "{\"id\":null,\"method\":\"mining.notify\",\"params\":[\"1f\","
+			"\"4d16b6f85af6e2198f44ae2a6de67f78487ae5611b77c6c0440b921e00000000\","
+			"\"01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff2703e83313"
+			"000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+			"000000000000000000000000000000000000000000000000000000000000000000000000\","
+			"\"ffffffff0100000000000000000000000000000000000000000000000000000000000000000000000000\","
+			"[],\"00000002\",\"1c2ac4af\",\"504e86b9\",true]}\n");
+	} else if (strstr(line, "\"mining.ping\"")) {
+		snprintf(s, sizeof(s), "{\"id\":%d,\"result\":null,\"error\":[20,\"Unknown method\",null]}\n", id);
+		fake_send(fd, s);
+		fp->pings++;
+	}
+}
+
+static void *fake_pool_thread(void *arg)
+{
+	struct fake_pool *fp = (struct fake_pool *) arg;
+	char buf[4096], *line, *nl;
+	size_t len = 0;
+	struct timeval tv;
+	fd_set rd;
+	ssize_t n;
+	int fd;
+
+	fd = accept(fp->lsock, NULL, NULL);
+	if (fd < 0) {
+		CHECK(0, "fake pool accept failed");
+		return NULL;
+	}
+
+	while (!done) {
+		if (fp->hang) {
+			usleep(5000);
+			continue;
+		}
+		FD_ZERO(&rd);
+		FD_SET(fd, &rd);
+		tv.tv_sec = 0;
+		tv.tv_usec = 10000;
+		if (select(fd + 1, &rd, NULL, NULL, &tv) <= 0)
+			continue;
+		n = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+		if (n <= 0)
+			break;
+		len += n;
+		buf[len] = '\0';
+		line = buf;
+		while ((nl = strchr(line, '\n'))) {
+			*nl = '\0';
+			fake_line(fp, fd, line);
+			line = nl + 1;
+		}
+		len -= line - buf;
+		memmove(buf, line, len);
+	}
+
+	close(fd);
+	return NULL;
+}
+
+/* The answers part of stratum_handle_response(), no shares here */
+static bool client_response(struct stratum_ctx *sctx, char *s)
+{
+	json_error_t err;
+	json_t *val = JSON_LOADS(s, &err);
+	bool ret;
+
+	if (!val)
+		return false;
+	ret = stratum_probe_answer(sctx, (int) json_integer_value(json_object_get(val, "id")));
+	json_decref(val);
+	return ret;
+}
+
+/* The failover part of stratum_check_job() */
+static void client_check(void)
+{
+	pthread_mutex_lock(&mining_lock);
+	stratum_switch(pools, 2, &mining, net_time_ms(), PROBE_MS);
+	pthread_mutex_unlock(&mining_lock);
+}
+
+static struct stratum_ctx *mined(void)
+{
+	struct stratum_ctx *sctx;
+
+	pthread_mutex_lock(&mining_lock);
+	sctx = mining;
+	pthread_mutex_unlock(&mining_lock);
+	return sctx;
+}
+
+/* stratum_thread() without the reconnects */
+static void *client_thread(void *arg)
+{
+	struct stratum_ctx *sctx = (struct stratum_ctx *) arg;
+	struct net_loop loop;
+
+	if (!net_loop_init(&loop) ||
+	    !stratum_connect(sctx, sctx->url) || !stratum_subscribe(sctx) ||
+	    !stratum_authorize(sctx, "user", "x", false) ||
+	    !stratum_loop_start(sctx, &loop)) {
+		CHECK(0, "pool %d handshake failed", sctx->pooln);
+		done = true;
+		return NULL;
+	}
+
+	while (!done) {
+		if (!stratum_loop_step(sctx, &loop, PROBE_MS, client_response, client_check)) {
+			CHECK(done, "pool %d connection dropped", sctx->pooln);
+			done = true;
+		}
+	}
+
+	stratum_disconnect(sctx);
+	net_loop_free(&loop);
+	return NULL;
+}
+
+/* Polls the pool mined on until it is want or limit ms went by,
+ * returns the time it took */
+static uint64_t wait_mined(struct stratum_ctx *want, uint64_t limit)
+{
+	uint64_t start = net_time_ms();
+
+	while (mined() != want && net_time_ms() - start < limit && !done)
+		usleep(5000);
+	return net_time_ms() - start;
+}
+
+static bool fake_pool_init(struct fake_pool *fp)
+{
+	struct sockaddr_in addr;
+	socklen_t alen = sizeof(addr);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	fp->lsock = socket(AF_INET, SOCK_STREAM, 0);
+	if (fp->lsock < 0 || bind(fp->lsock, (struct sockaddr *) &addr, sizeof(addr)) ||
+	    listen(fp->lsock, 1) || getsockname(fp->lsock, (struct sockaddr *) &addr, &alen))
+		return false;
+	fp->port = ntohs(addr.sin_port);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t fake_thr[2], client_thr[2];
+	uint64_t t, start;
+	int i;
+
+	if (argc > 1 && !strcmp(argv[1], "-D"))
+		opt_debug = opt_protocol = true;
+
+	signal(SIGPIPE, SIG_IGN);
+	alarm(60);
+
+	for (i = 0; i < 2; i++) {
+		if (!fake_pool_init(&fakes[i])) {
+			fprintf(stderr, "no loopback socket, skipped\n");
+			return 77;
+		}
+		pools[i].pooln = i;
+		pools[i].url = (char *) malloc(64);
+		sprintf(pools[i].url, "stratum+tcp://127.0.0.1:%d", fakes[i].port);
+		pthread_mutex_init(&pools[i].sock_lock, NULL);
+		pthread_mutex_init(&pools[i].work_lock, NULL);
+		pthread_mutex_init(&pools[i].submit_lock, NULL);
+		pthread_create(&fake_thr[i], NULL, fake_pool_thread, &fakes[i]);
+		pthread_create(&client_thr[i], NULL, client_thread, &pools[i]);
+	}
+
+	/* both connected with a job, the first one mined on; the backup
+	 * is mined on meanwhile if its job comes first */
+	start = net_time_ms();
+	while (!done && net_time_ms() - start < 5000) {
+		bool have_jobs = true;
+
+		for (i = 0; i < 2; i++) {
+			pthread_mutex_lock(&pools[i].work_lock);
+			have_jobs = have_jobs && pools[i].job.job_id != NULL;
+			pthread_mutex_unlock(&pools[i].work_lock);
+		}
+		if (have_jobs)
+			break;
+		usleep(5000);
+	}
+	t = wait_mined(&pools[0], 5000);
+	CHECK(mined() == &pools[0], "pool 0 not mined on after %u ms", (uint32_t) t);
+
+	/* quiet pools answering their probes are not failed over from */
+	start = net_time_ms();
+	while (net_time_ms() - start < 5 * PROBE_MS && !done) {
+		if (mined() != &pools[0]) {
+			CHECK(0, "failed over from a quiet pool");
+			break;
+		}
+		usleep(5000);
+	}
+	CHECK(fakes[0].pings >= 2, "pool 0 answered %d probes", fakes[0].pings);
+	CHECK(fakes[1].pings >= 2, "pool 1 answered %d probes", fakes[1].pings);
+
+	/* the first pool hangs, the probe goes unanswered */
+	fakes[0].hang = true;
+	t = wait_mined(&pools[1], 10 * PROBE_MS);
+	CHECK(mined() == &pools[1] && t <= 2 * PROBE_MS + SLACK_MS,
+		"failover took %u ms, expected at most %u", (uint32_t) t, 2 * PROBE_MS + SLACK_MS);
+	printf("failover to the backup after %u ms\n", (uint32_t) t);
+
+	/* it answers the waiting probe once it is back */
+	fakes[0].hang = false;
+	t = wait_mined(&pools[0], 10 * PROBE_MS);
+	CHECK(mined() == &pools[0] && t <= SLACK_MS,
+		"switching back took %u ms, expected at most %u", (uint32_t) t, SLACK_MS);
+	printf("back to the first pool after %u ms\n", (uint32_t) t);
+
+	/* end the waits of both loops */
+	done = true;
+	for (i = 0; i < 2; i++) {
+		pthread_mutex_lock(&pools[i].sock_lock);
+		if (pools[i].loop)
+			net_loop_wake(pools[i].loop);
+		pthread_mutex_unlock(&pools[i].sock_lock);
+	}
+	for (i = 0; i < 2; i++) {
+		pthread_join(client_thr[i], NULL);
+		pthread_join(fake_thr[i], NULL);
+		close(fakes[i].lsock);
+	}
+
+	printf(failures ? "FAIL\n" : "PASS\n");
+	return failures ? 1 : 0;
+}
+#endif /* WIN32 */
@@ -0,0 +1,221 @@
+/**
+ * Known answer and cross-check tests of the CPU hashing code
+ *
+ * Shared by --selftest and the hashtest program run by "make check",
+ * so this file must only depend on neoscrypt.c, neoscrypt_simd.c and
+ * sha256.cpp; failures are reported through applog().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "miner.h"
+#include "log.h"
+
+extern void sha256d(unsigned char *hash, const unsigned char *data, int len);
+extern void sha256_midstate(uint32_t *state, const unsigned char *data, int len);
+extern void sha256d_multi_mid(unsigned char *hash, const uint32_t *midstate,
+	const unsigned char *data, int len, int total, int count);
+extern void sha256d_multi(unsigned char *hash, const unsigned char *data, int len, int count);
+extern int sha256_set_8way(int on);
+
+/* Number of random inputs cross-checked by hash_selftest_cpu() */
+#define SELFTEST_RANDOM 40
+/* Messages per sha256d_multi_mid() call, two groups of 8 and a rest */
+#define SELFTEST_SHA_COUNT 19
+/* Longest message tail after the midstate */
+#define SELFTEST_SHA_TAIL 150
+
+bool selftest_compare(const char *name, const uchar *hash, const char *expect)
+{
+	char s[65];
+	int i;
+
+	for (i = 0; i < 32; i++)
+		sprintf(&s[i * 2], "%02x", hash[i]);
+	if (!strcmp(s, expect))
+		return true;
+
+	applog(LOG_ERR, "Self test: %s mismatch", name);
+	applog(LOG_ERR, "  got      %s", s);
+	applog(LOG_ERR, "  expected %s", expect);
+	return false;
+}
+
+static bool selftest_match(const char *name, uint32_t seed, uint i,
+	const uchar *hash, const uchar *ref)
+{
+	if (!memcmp(hash, ref, 32))
+		return true;
+
+	applog(LOG_ERR, "Self test: %s differs from neoscrypt() (seed %08x, input %u)",
+		name, seed, i);
+	return false;
+}
+
+static bool selftest_sha_match(const char *name, uint32_t seed, int way8,
+	int prefix, int tail, int i, const uchar *hash, const uchar *ref)
+{
+	if (!memcmp(hash, ref, 32))
+		return true;
+
+	applog(LOG_ERR, "Self test: %s%s differs from sha256d() (seed %08x, prefix %d, tail %d, message %d)",
+		name, way8 ? " 8-way" : "", seed, prefix, tail, i);
+	return false;
+}
+
+/* sha256d_multi_mid() and sha256d_multi() against sha256d() of each
+ * whole message: prefixes of 0, 1 and 2 blocks in the midstate, tails
+ * of 1 to SELFTEST_SHA_TAIL bytes so the padding takes one block or
+ * two, and a count that is not a multiple of 8. Runs once more with
+ * the AVX2 8-way path forced on where the CPU has it, since SHA-NI
+ * CPUs would never take it */
+static bool selftest_sha256_multi(uint32_t seed)
+{
+	uchar msg[128 + SELFTEST_SHA_TAIL];
+	uchar tails[SELFTEST_SHA_COUNT * SELFTEST_SHA_TAIL];
+	uchar hash[SELFTEST_SHA_COUNT * 32], ref[32];
+	uint32_t mid[8];
+	int prev, way8, prefix, tail, i, k;
+	bool rc = true;
+
+	prev = sha256_set_8way(0);
+	for (way8 = 0; way8 <= (prev >= 0) && rc; way8++) {
+		if (prev >= 0)
+			sha256_set_8way(way8);
+
+		for (prefix = 0; prefix <= 128 && rc; prefix += 64) {
+			for (tail = 1; tail <= SELFTEST_SHA_TAIL && rc; tail++) {
+				for (k = 0; k < prefix; k++)
+					msg[k] = (uchar) rand();
+				for (k = 0; k < SELFTEST_SHA_COUNT * tail; k++)
+					tails[k] = (uchar) rand();
+
+				sha256_midstate(mid, msg, prefix);
+				sha256d_multi_mid(hash, mid, tails, tail, prefix + tail, SELFTEST_SHA_COUNT);
+				for (i = 0; i < SELFTEST_SHA_COUNT && rc; i++) {
+					memcpy(&msg[prefix], &tails[i * tail], tail);
+					sha256d(ref, msg, prefix + tail);
+					rc = selftest_sha_match("sha256d_multi_mid()", seed, way8,
+						prefix, tail, i, &hash[i * 32], ref);
+				}
+
+				if (prefix)
+					continue;
+				sha256d_multi(hash, tails, tail, SELFTEST_SHA_COUNT);
+				for (i = 0; i < SELFTEST_SHA_COUNT && rc; i++) {
+					sha256d(ref, &tails[i * tail], tail);
+					rc = selftest_sha_match("sha256d_multi()", seed, way8,
+						prefix, tail, i, &hash[i * 32], ref);
+				}
+			}
+		}
+	}
+
+	if (prev >= 0)
+		sha256_set_8way(prev);
+	return rc;
+}
+
+/* Runs the published test vectors and compares the optimised CPU paths
+ * against the reference neoscrypt() over random inputs made from seed;
+ * returns false if anything does not match */
+bool hash_selftest_cpu(uint32_t seed)
+{
+	uchar data[SELFTEST_RANDOM * 80], hash[SELFTEST_RANDOM * 32], ref[SELFTEST_RANDOM * 32];
+	uint32_t key[8], target[8], first, nonce;
+	neoscrypt_job job;
+	neoscrypt_arena arena;
+	bool rc = true;
+	uint i;
+
+	/* NeoScrypt reference test vector, input bytes 0 to 79 */
+	for (i = 0; i < 80; i++)
+		data[i] = (uchar) i;
+	neoscrypt(data, hash);
+	rc &= selftest_compare("neoscrypt", hash,
+		"7258961afb33fd12d00cacb8d63f4f4f52bb6917043865dd24a08f578853122d");
+
+	/* BLAKE2s known answers with key bytes 0 to 31 */
+	for (i = 0; i < 32; i++)
+		((uchar *) key)[i] = (uchar) i;
+	neoscrypt_blake2s(data, 0, key, 32, hash, 32);
+	rc &= selftest_compare("blake2s, empty input", hash,
+		"48a8997da407876b3d79c0d92325ad3b89cbb754d86ab71aee047ad345fd2c49");
+	neoscrypt_blake2s(data, 64, key, 32, hash, 32);
+	rc &= selftest_compare("blake2s, 64 bytes", hash,
+		"8975b0577fd35566d750b362b0897a26c399136df07bababbde6203ff2954ed4");
+
+	/* SHA-256d */
+	sha256d(hash, (const uchar *) "abc", 3);
+	rc &= selftest_compare("sha256d, abc", hash,
+		"4f8b42c22dd3729b519ba6f68d2da7cc5b2d606d05daed5ad5128cc03e6c6358");
+	sha256d(hash, data, 80);
+	rc &= selftest_compare("sha256d, 80 bytes", hash,
+		"852c98044fb00507122ff63bda7b529566348fc204f72b00dff1afd7b40501e4");
+
+	if (!rc)
+		return false;
+
+	/* Random headers, all of the optimised paths must agree */
+	srand(seed);
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (uchar) rand();
+
+	for (i = 0; i < SELFTEST_RANDOM; i++)
+		neoscrypt(&data[i * 80], &ref[i * 32]);
+
+	neoscrypt_multi(data, hash, SELFTEST_RANDOM, NULL);
+	for (i = 0; i < SELFTEST_RANDOM && rc; i++)
+		rc = selftest_match("neoscrypt_multi()", seed, i, &hash[i * 32], &ref[i * 32]);
+
+	/* neoscrypt() mixes with one V on the stack, neoscrypt_core() in
+	 * lockstep with two in an arena */
+	if (rc && !neoscrypt_arena_init(&arena, 0)) {
+		for (i = 0; i < SELFTEST_RANDOM && rc; i++) {
+			neoscrypt_core(&data[i * 80], hash, arena.mem);
+			rc = selftest_match("neoscrypt_core()", seed, i, hash, &ref[i * 32]);
+		}
+		memcpy(&first, &data[76], 4);
+		neoscrypt_job_init(&job, data);
+		neoscrypt_job_core(&job, first, hash, arena.mem);
+		rc &= selftest_match("neoscrypt_job_core()", seed, 0, hash, ref);
+		neoscrypt_arena_free(&arena);
+	}
+
+	for (i = 0; i < SELFTEST_RANDOM && rc; i++) {
+		neoscrypt_profile(&data[i * 80], hash, 0x80000000 | (6 << 8) | (1 << 5));
+		rc = selftest_match("neoscrypt_profile()", seed, i, hash, &ref[i * 32]);
+	}
+
+	/* A hash exactly at the target passes, one just above does not */
+	for (i = 0; i < SELFTEST_RANDOM && rc; i++) {
+		memcpy(target, &ref[i * 32], 32);
+		if (!neoscrypt_check(&data[i * 80], target))
+			rc = false;
+		if (target[7] && (target[7]--, neoscrypt_check(&data[i * 80], target)))
+			rc = false;
+		if (!rc)
+			applog(LOG_ERR, "Self test: neoscrypt_check() disagrees with neoscrypt() (seed %08x, input %u)",
+				seed, i);
+	}
+
+	/* Consecutive nonces of the 1st header */
+	memcpy(&first, &data[76], 4);
+	for (i = 0; i < SELFTEST_RANDOM; i++) {
+		nonce = first + i;
+		if (i)
+			memcpy(&data[i * 80], data, 76);
+		memcpy(&data[i * 80 + 76], &nonce, 4);
+		neoscrypt(&data[i * 80], &ref[i * 32]);
+	}
+	neoscrypt_job_init(&job, data);
+	neoscrypt_job_multi(&job, first, hash, SELFTEST_RANDOM, NULL);
+	for (i = 0; i < SELFTEST_RANDOM && rc; i++)
+		rc = selftest_match("neoscrypt_job_multi()", seed, i, &hash[i * 32], &ref[i * 32]);
+
+	if (rc)
+		rc = selftest_sha256_multi(seed);
+
+	return rc;
+}
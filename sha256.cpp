@@ -163,34 +163,315 @@ void sha256_transform(uint32_t *state, const uint32_t *block, int swap)
 		state[i] += S[i];
 }
 
-static const uint32_t sha256d_hash1[16] = {
-	0x00000000, 0x00000000, 0x00000000, 0x00000000,
-	0x00000000, 0x00000000, 0x00000000, 0x00000000,
-	0x80000000, 0x00000000, 0x00000000, 0x00000000,
-	0x00000000, 0x00000000, 0x00000000, 0x00000100
-};
+/* Compresses blocks 64-byte big endian message blocks into state */
+typedef void (*sha256_blocks_t)(uint32_t *state, const uchar *data, size_t blocks);
+
+static void sha256_blocks_generic(uint32_t *state, const uchar *data, size_t blocks)
+{
+	uint32_t T[16];
+	int i;
+
+	for (; blocks; blocks--, data += 64) {
+		for (i = 0; i < 16; i++)
+			T[i] = be32dec(data + 4 * i);
+		sha256_transform(state, T, 0);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SHA256_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SHA256_TARGET_SHA
+#define SHA256_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define SHA256_TARGET_SHA  __attribute__((target("sha,sse4.1")))
+#define SHA256_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#include <immintrin.h>
+#endif
+
+#if defined(SHA256_X86) && defined(USE_SHA)
+/* SHA extensions; the state is kept as ABEF and CDGH halves */
+static SHA256_TARGET_SHA void sha256_blocks_sha(uint32_t *state, const uchar *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, save0, save1, msg, tmp, M[4];
+	int i;
+
+	tmp    = _mm_loadu_si128((const __m128i *) &state[0]);
+	state1 = _mm_loadu_si128((const __m128i *) &state[4]);
+	tmp    = _mm_shuffle_epi32(tmp, 0xB1);
+	state1 = _mm_shuffle_epi32(state1, 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for (; blocks; blocks--, data += 64) {
+		save0 = state0;
+		save1 = state1;
+
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				M[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)), mask);
+			} else {
+				/* W[t..t+3] from W[t-16..t-1] */
+				tmp = _mm_add_epi32(_mm_sha256msg1_epu32(M[i & 3], M[(i + 1) & 3]),
+					_mm_alignr_epi8(M[(i + 3) & 3], M[(i + 2) & 3], 4));
+				M[i & 3] = _mm_sha256msg2_epu32(tmp, M[(i + 3) & 3]);
+			}
+			msg = _mm_add_epi32(M[i & 3], _mm_loadu_si128((const __m128i *) &sha256_k[4 * i]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0E);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+
+		state0 = _mm_add_epi32(state0, save0);
+		state1 = _mm_add_epi32(state1, save1);
+	}
+
+	tmp    = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+	_mm_storeu_si128((__m128i *) &state[0], state0);
+	_mm_storeu_si128((__m128i *) &state[4], state1);
+}
+#endif
+
+#if defined(SHA256_X86) && defined(USE_AVX2)
+/* AVX2: 8 independent messages, one per 32-bit lane;
+ * the block of lane l is read at data + l * stride */
+#define V_ADD(a, b)   _mm256_add_epi32(a, b)
+#define V_XOR(a, b)   _mm256_xor_si256(a, b)
+#define V_ROTR(x, n)  _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define V_CH(x, y, z) V_XOR(_mm256_and_si256(x, V_XOR(y, z)), z)
+#define V_MAJ(x, y, z) _mm256_or_si256(_mm256_and_si256(x, _mm256_or_si256(y, z)), _mm256_and_si256(y, z))
+#define V_S0(x) V_XOR(V_XOR(V_ROTR(x, 2), V_ROTR(x, 13)), V_ROTR(x, 22))
+#define V_S1(x) V_XOR(V_XOR(V_ROTR(x, 6), V_ROTR(x, 11)), V_ROTR(x, 25))
+#define V_s0(x) V_XOR(V_XOR(V_ROTR(x, 7), V_ROTR(x, 18)), _mm256_srli_epi32(x, 3))
+#define V_s1(x) V_XOR(V_XOR(V_ROTR(x, 17), V_ROTR(x, 19)), _mm256_srli_epi32(x, 10))
+
+static SHA256_TARGET_AVX2 void sha256_blocks_8way(__m256i *state, const uchar *data,
+	size_t stride, size_t blocks)
+{
+	__m256i W[64], S[8], t0, t1;
+	uint32_t T[8];
+	int i, l;
+
+	for (; blocks; blocks--, data += 64) {
+		for (i = 0; i < 16; i++) {
+			for (l = 0; l < 8; l++)
+				T[l] = be32dec(data + l * stride + 4 * i);
+			W[i] = _mm256_loadu_si256((const __m256i *) T);
+		}
+		for (i = 16; i < 64; i++)
+			W[i] = V_ADD(V_ADD(V_s1(W[i - 2]), W[i - 7]), V_ADD(V_s0(W[i - 15]), W[i - 16]));
+
+		for (i = 0; i < 8; i++)
+			S[i] = state[i];
+
+		for (i = 0; i < 64; i++) {
+			t0 = V_ADD(V_ADD(S[7], V_S1(S[4])), V_ADD(V_CH(S[4], S[5], S[6]),
+				V_ADD(W[i], _mm256_set1_epi32(sha256_k[i]))));
+			t1 = V_ADD(V_S0(S[0]), V_MAJ(S[0], S[1], S[2]));
+			S[7] = S[6];
+			S[6] = S[5];
+			S[5] = S[4];
+			S[4] = V_ADD(S[3], t0);
+			S[3] = S[2];
+			S[2] = S[1];
+			S[1] = S[0];
+			S[0] = V_ADD(t0, t1);
+		}
+
+		for (i = 0; i < 8; i++)
+			state[i] = V_ADD(state[i], S[i]);
+	}
+}
+#endif
+
+/* Best single message backend of this CPU */
+static sha256_blocks_t sha256_blocks_best(void)
+{
+#if defined(SHA256_X86) && defined(USE_SHA)
+	uint32_t ecx1, ebx7;
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 1);
+	ecx1 = info[2];
+	__cpuidex(info, 7, 0);
+	ebx7 = info[1];
+#else
+	uint32_t eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return sha256_blocks_generic;
+	ecx1 = ecx;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return sha256_blocks_generic;
+	ebx7 = ebx;
+#endif
+	/* SHA, SSSE3 and SSE4.1 */
+	if ((ebx7 & (1 << 29)) && (ecx1 & (1 << 9)) && (ecx1 & (1 << 19)))
+		return sha256_blocks_sha;
+#endif
+	return sha256_blocks_generic;
+}
+
+/* Set once by sha256_cpu_init() before any thread hashes */
+static sha256_blocks_t sha256_blocks = sha256_blocks_generic;
+static bool sha256_8way = false;
+
+/* Picks the SHA-256 backends of this CPU and runs the NeoScrypt
+ * extension detection with it; call from main() before the worker
+ * threads start, the hash functions only read the result */
+void sha256_cpu_init(void)
+{
+	uint exts = neoscrypt_cpu_exts();
+
+	sha256_blocks = sha256_blocks_best();
+	sha256_8way = (sha256_blocks == sha256_blocks_generic) &&
+		(exts & NEOSCRYPT_EXT_AVX2);
+}
+
+/* Turns the AVX2 8-way path of sha256d_multi_mid() on or off whatever
+ * sha256_cpu_init() chose, so the self test reaches it on SHA-NI CPUs
+ * too; same threading rule as sha256_cpu_init(). Returns the previous
+ * setting, or -1 if this build or CPU has no 8-way path */
+int sha256_set_8way(int on)
+{
+#if defined(SHA256_X86) && defined(USE_AVX2)
+	int prev = sha256_8way;
+
+	if (!(neoscrypt_cpu_exts() & NEOSCRYPT_EXT_AVX2))
+		return -1;
+	sha256_8way = (on != 0);
+	return prev;
+#else
+	return -1;
+#endif
+}
+
+/* Pads the last rem bytes of a len byte message from tail into buf;
+ * returns the number of 64-byte blocks written */
+static size_t sha256_pad(uchar *buf, const uchar *tail, size_t rem, size_t len)
+{
+	size_t blocks = (rem < 56) ? 1 : 2;
+
+	memmove(buf, tail, rem);
+	memset(buf + rem, 0, blocks * 64 - rem);
+	buf[rem] = 0x80;
+	be32enc(buf + blocks * 64 - 8, (uint32_t) ((uint64_t) len >> 29));
+	be32enc(buf + blocks * 64 - 4, (uint32_t) (len << 3));
+
+	return blocks;
+}
+
+/* Finishes sha256d() of a total byte message whose first total - len
+ * bytes are hashed into state already and the last len are at data */
+static void sha256d_finish(uchar *hash, uint32_t *state, const uchar *data,
+	size_t len, size_t total)
+{
+	uchar buf[128];
+	size_t blocks;
+	int i;
+
+	sha256_blocks(state, data, len / 64);
+	blocks = sha256_pad(buf, data + (len & ~63), len & 63, total);
+	sha256_blocks(state, buf, blocks);
+
+	for (i = 0; i < 8; i++)
+		be32enc(buf + 4 * i, state[i]);
+	sha256_pad(buf, buf, 32, 32);
+	sha256_init(state);
+	sha256_blocks(state, buf, 1);
+
+	for (i = 0; i < 8; i++)
+		be32enc(hash + 4 * i, state[i]);
+}
 
 void sha256d(unsigned char *hash, const unsigned char *data, int len)
 {
-	uint32_t S[16], T[16];
-	int i, r;
+	uint32_t S[8];
 
 	sha256_init(S);
-	for (r = len; r > -9; r -= 64) {
-		if (r < 64)
-			memset(T, 0, 64);
-		memcpy(T, data + len - r, r > 64 ? 64 : (r < 0 ? 0 : r));
-		if (r >= 0 && r < 64)
-			((unsigned char *)T)[r] = 0x80;
-		for (i = 0; i < 16; i++)
-			T[i] = be32dec(T + i);
-		if (r < 56)
-			T[15] = 8 * len;
-		sha256_transform(S, T, 0);
+	sha256d_finish(hash, S, data, len, len);
+}
+
+/* SHA-256 state after the whole 64-byte blocks of the first len bytes
+ * of data, to resume from with sha256d_multi_mid() */
+void sha256_midstate(uint32_t *state, const unsigned char *data, int len)
+{
+	sha256_init(state);
+	sha256_blocks(state, data, len / 64);
+}
+
+#if defined(SHA256_X86) && defined(USE_AVX2)
+/* sha256d_finish() of 8 messages with the same midstate, the tails
+ * of len bytes back to back in data */
+static SHA256_TARGET_AVX2 void sha256d_8way(uchar *hash, const uint32_t *midstate,
+	const uchar *data, size_t len, size_t total)
+{
+	__m256i S[8];
+	uchar buf[8 * 128];
+	uint32_t T[8];
+	size_t blocks = 0;
+	int i, l;
+
+	for (i = 0; i < 8; i++)
+		S[i] = _mm256_set1_epi32(midstate[i]);
+	sha256_blocks_8way(S, data, len, len / 64);
+	for (l = 0; l < 8; l++)
+		blocks = sha256_pad(&buf[l * 128], data + l * len + (len & ~63), len & 63, total);
+	sha256_blocks_8way(S, buf, 128, blocks);
+
+	for (i = 0; i < 8; i++) {
+		_mm256_storeu_si256((__m256i *) T, S[i]);
+		for (l = 0; l < 8; l++)
+			be32enc(&buf[l * 64 + 4 * i], T[l]);
 	}
-	memcpy(S + 8, sha256d_hash1 + 8, 32);
-	sha256_init(T);
-	sha256_transform(T, S, 0);
+	for (l = 0; l < 8; l++)
+		sha256_pad(&buf[l * 64], &buf[l * 64], 32, 32);
 	for (i = 0; i < 8; i++)
-		be32enc((uint32_t *)hash + i, T[i]);
+		S[i] = _mm256_set1_epi32(sha256_h[i]);
+	sha256_blocks_8way(S, buf, 64, 1);
+
+	for (i = 0; i < 8; i++) {
+		_mm256_storeu_si256((__m256i *) T, S[i]);
+		for (l = 0; l < 8; l++)
+			be32enc(hash + l * 32 + 4 * i, T[l]);
+	}
+}
+#endif
+
+/* sha256d() of count messages of total bytes each which share their
+ * first total - len bytes, already hashed into midstate by
+ * sha256_midstate(); data holds the count tails of len bytes back to
+ * back. Uses the SHA extensions one by one if the CPU has them,
+ * otherwise AVX2 eight at a time */
+void sha256d_multi_mid(unsigned char *hash, const uint32_t *midstate,
+	const unsigned char *data, int len, int total, int count)
+{
+	uint32_t S[8];
+	int i = 0;
+
+#if defined(SHA256_X86) && defined(USE_AVX2)
+	if (sha256_8way) {
+		for (; i + 8 <= count; i += 8)
+			sha256d_8way(hash + i * 32, midstate, data + i * len, len, total);
+	}
+#endif
+
+	for (; i < count; i++) {
+		memcpy(S, midstate, 32);
+		sha256d_finish(hash + i * 32, S, data + i * len, len, total);
+	}
+}
+
+/* sha256d() of count messages of len bytes each, back to back in data */
+void sha256d_multi(unsigned char *hash, const unsigned char *data, int len, int count)
+{
+	sha256d_multi_mid(hash, sha256_h, data, len, len, count);
 }
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2010 Jeff Garzik
+ * Copyright 2012-2014 pooler
+ * Copyright 2014 ccminer team
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.  See COPYING for more details.
+ */
+
+/* Share target helpers, kept apart from util.cpp so that
+ * cudaminer-bench can link them without the network code */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "miner.h"
+#include "log.h"
+
+bool fulltest(const uint32_t *hash, const uint32_t *target)
+{
+	int i;
+	bool rc = true;
+	
+	for (i = 7; i >= 0; i--) {
+		if (hash[i] > target[i]) {
+			rc = false;
+			break;
+		}
+		if (hash[i] < target[i]) {
+			rc = true;
+			break;
+		}
+		if (hash[1] == target[1]) {
+			applog(LOG_NOTICE, "We found a close match!");
+		}
+	}
+
+	if (!rc && opt_debug) {
+		char hash_str[65], target_str[65];
+
+		/* most significant word first, as bin2hex() of the be32 words */
+		for (i = 0; i < 8; i++) {
+			sprintf(&hash_str[i * 8], "%08x", hash[7 - i]);
+			sprintf(&target_str[i * 8], "%08x", target[7 - i]);
+		}
+
+		applog(LOG_DEBUG, "DEBUG: %s\nHash:   %s\nTarget: %s",
+			rc ? "hash <= target"
+			   : CL_YLW "hash > target (false positive)" CL_N,
+			hash_str,
+			target_str);
+	}
+
+	return rc;
+}
+
+void diff_to_target(uint32_t *target, double diff)
+{
+	uint64_t m;
+	int k;
+	
+	for (k = 6; k > 0 && diff > 1.0; k--)
+		diff /= 4294967296.0;
+	m = (uint64_t)(4294901760.0 / diff);
+	if (m == 0 && k == 6)
+		memset(target, 0xff, 32);
+	else {
+		memset(target, 0, 32);
+		target[k] = (uint32_t)m;
+		target[k + 1] = (uint32_t)(m >> 32);
+	}
+}
@@ -32,6 +32,8 @@
 #include "log.h"
 #include "elist.h"
 
+extern void sha256_midstate(uint32_t *state, const unsigned char *data, int len);
+
 bool opt_tracegpu = false;
 
 struct data_buffer {
@@ -568,66 +570,6 @@ int timeval_subtract(struct timeval *result, struct timeval *x,
 	return (start > end);
 }
 
-bool fulltest(const uint32_t *hash, const uint32_t *target)
-{
-	int i;
-	bool rc = true;
-	
-	for (i = 7; i >= 0; i--) {
-		if (hash[i] > target[i]) {
-			rc = false;
-			break;
-		}
-		if (hash[i] < target[i]) {
-			rc = true;
-			break;
-		}
-		if (hash[1] == target[1]) {
-			applog(LOG_NOTICE, "We found a close match!");
-		}
-	}
-
-	if (!rc && opt_debug) {
-		uint32_t hash_be[8], target_be[8];
-		char *hash_str, *target_str;
-		
-		for (i = 0; i < 8; i++) {
-			be32enc(hash_be + i, hash[7 - i]);
-			be32enc(target_be + i, target[7 - i]);
-		}
-		hash_str = bin2hex((uchar *)hash_be, 32);
-		target_str = bin2hex((uchar *)target_be, 32);
-
-		applog(LOG_DEBUG, "DEBUG: %s\nHash:   %s\nTarget: %s",
-			rc ? "hash <= target"
-			   : CL_YLW "hash > target (false positive)" CL_N,
-			hash_str,
-			target_str);
-
-		free(hash_str);
-		free(target_str);
-	}
-
-	return rc;
-}
-
-void diff_to_target(uint32_t *target, double diff)
-{
-	uint64_t m;
-	int k;
-	
-	for (k = 6; k > 0 && diff > 1.0; k--)
-		diff /= 4294967296.0;
-	m = (uint64_t)(4294901760.0 / diff);
-	if (m == 0 && k == 6)
-		memset(target, 0xff, 32);
-	else {
-		memset(target, 0, 32);
-		target[k] = (uint32_t)m;
-		target[k + 1] = (uint32_t)(m >> 32);
-	}
-}
-
 #ifdef WIN32
 #define socket_blocks() (WSAGetLastError() == WSAEWOULDBLOCK)
 #else
@@ -670,8 +612,18 @@ bool stratum_send_line(struct stratum_ctx *sctx, char *s)
 	if (opt_protocol)
 		applog(LOG_DEBUG, "> %s", s);
 
+	/* After the handshake the network loop does the sending,
+	 * without blocking the caller */
 	pthread_mutex_lock(&sctx->sock_lock);
-	ret = send_line(sctx->sock, s);
+	if (sctx->loop) {
+		ret = net_queue_push(&sctx->sendq, s);
+		if (ret)
+			net_loop_wake(sctx->loop);
+		else
+			applog(LOG_ERR, "stratum_send_line: out of memory queueing %u bytes",
+				(uint32_t) strlen(s));
+	} else
+		ret = send_line(sctx->sock, s);
 	pthread_mutex_unlock(&sctx->sock_lock);
 
 	return ret;
@@ -693,31 +645,90 @@ static bool socket_full(curl_socket_t sock, int timeout)
 
 bool stratum_socket_full(struct stratum_ctx *sctx, int timeout)
 {
-	return strlen(sctx->sockbuf) || socket_full(sctx->sock, timeout);
+	return sctx->sockbuf_tail > sctx->sockbuf_head || socket_full(sctx->sock, timeout);
 }
 
-#define RBUFSIZE 2048
-#define RECVSIZE (RBUFSIZE - 4)
+/* Receives into the free end of the buffer; the pending partial line is
+ * moved to the front first if the end is reached, which happens at most
+ * once per line; returns what recv() did, or -1 with a full buffer */
+static ssize_t stratum_buffer_recv(struct stratum_ctx *sctx)
+{
+	ssize_t n;
+
+	if (sctx->sockbuf_head == sctx->sockbuf_tail) {
+		sctx->sockbuf_head = sctx->sockbuf_scan = sctx->sockbuf_tail = 0;
+	} else if (sctx->sockbuf_tail == STRATUM_RBUF_SIZE) {
+		if (!sctx->sockbuf_head) {
+			applog(LOG_ERR, "stratum_recv_line: line longer than %d bytes", STRATUM_RBUF_SIZE);
+			return -1;
+		}
+		memmove(sctx->sockbuf, sctx->sockbuf + sctx->sockbuf_head,
+			sctx->sockbuf_tail - sctx->sockbuf_head);
+		sctx->sockbuf_tail -= sctx->sockbuf_head;
+		sctx->sockbuf_scan -= sctx->sockbuf_head;
+		sctx->sockbuf_head = 0;
+	}
+
+	n = recv(sctx->sock, sctx->sockbuf + sctx->sockbuf_tail,
+		STRATUM_RBUF_SIZE - sctx->sockbuf_tail, 0);
+	if (n > 0)
+		sctx->sockbuf_tail += n;
+	return n;
+}
 
-static void stratum_buffer_append(struct stratum_ctx *sctx, const char *s)
+/* Next non-empty line already received, terminated in place, or NULL;
+ * every byte is scanned for the newline only once */
+static char *stratum_buffer_line(struct stratum_ctx *sctx)
 {
-	size_t old, snew;
+	char *line, *nl;
 
-	old = strlen(sctx->sockbuf);
-	snew = old + strlen(s) + 1;
-	if (snew >= sctx->sockbuf_size) {
-		sctx->sockbuf_size = snew + (RBUFSIZE - (snew % RBUFSIZE));
-		sctx->sockbuf = (char*)realloc(sctx->sockbuf, sctx->sockbuf_size);
+	while (sctx->sockbuf_scan < sctx->sockbuf_tail) {
+		nl = (char *) memchr(sctx->sockbuf + sctx->sockbuf_scan, '\n',
+			sctx->sockbuf_tail - sctx->sockbuf_scan);
+		if (!nl) {
+			sctx->sockbuf_scan = sctx->sockbuf_tail;
+			break;
+		}
+		*nl = '\0';
+		line = sctx->sockbuf + sctx->sockbuf_head;
+		sctx->sockbuf_head = sctx->sockbuf_scan = nl - sctx->sockbuf + 1;
+		if (nl > line)
+			return line;
 	}
-	strcpy(sctx->sockbuf + old, s);
+	return NULL;
+}
+
+/* Reads what the socket has without waiting, for the network loop;
+ * false if the connection is closed or broken */
+bool stratum_recv_nonblock(struct stratum_ctx *sctx)
+{
+	ssize_t n = stratum_buffer_recv(sctx);
+
+	if (n > 0)
+		return true;
+	if (!n || sctx->sockbuf_tail == STRATUM_RBUF_SIZE)
+		return false;
+	return socket_blocks();
+}
+
+/* Next line already received or NULL, as stratum_recv_line() returns it */
+char *stratum_next_line(struct stratum_ctx *sctx)
+{
+	char *sret = stratum_buffer_line(sctx);
+
+	if (sret && opt_protocol)
+		applog(LOG_DEBUG, "< %s", sret);
+	return sret;
 }
 
+/* Returns the next line from the pool, pointing into the receive buffer:
+ * valid until the next call on sctx and not to be freed */
 char *stratum_recv_line(struct stratum_ctx *sctx)
 {
-	ssize_t len, buflen;
-	char *tok, *sret = NULL;
+	char *sret;
 
-	if (!strstr(sctx->sockbuf, "\n")) {
+	sret = stratum_buffer_line(sctx);
+	if (!sret) {
 		bool ret = true;
 		time_t rstart = time(NULL);
 		if (!socket_full(sctx->sock, 60)) {
@@ -725,44 +736,28 @@ char *stratum_recv_line(struct stratum_ctx *sctx)
 			goto out;
 		}
 		do {
-			char s[RBUFSIZE];
-			ssize_t n;
-
-			memset(s, 0, RBUFSIZE);
-			n = recv(sctx->sock, s, RECVSIZE, 0);
+			ssize_t n = stratum_buffer_recv(sctx);
 			if (!n) {
 				ret = false;
 				break;
 			}
 			if (n < 0) {
-				if (!socket_blocks() || !socket_full(sctx->sock, 1)) {
+				if (sctx->sockbuf_tail == STRATUM_RBUF_SIZE || !socket_blocks() ||
+				    !socket_full(sctx->sock, 1)) {
 					ret = false;
 					break;
 				}
 			} else
-				stratum_buffer_append(sctx, s);
-		} while (time(NULL) - rstart < 60 && !strstr(sctx->sockbuf, "\n"));
+				sret = stratum_buffer_line(sctx);
+		} while (time(NULL) - rstart < 60 && !sret);
 
-		if (!ret) {
+		if (!ret || !sret) {
 			applog(LOG_ERR, "stratum_recv_line failed");
+			sret = NULL;
 			goto out;
 		}
 	}
 
-	buflen = (ssize_t)strlen(sctx->sockbuf);
-	tok = strtok(sctx->sockbuf, "\n");
-	if (!tok) {
-		applog(LOG_ERR, "stratum_recv_line failed to parse a newline-terminated string");
-		goto out;
-	}
-	sret = strdup(tok);
-	len = (ssize_t)strlen(sret);
-
-	if (buflen > len + 1)
-		memmove(sctx->sockbuf, sctx->sockbuf + len + 1, buflen - len + 1);
-	else
-		sctx->sockbuf[0] = '\0';
-
 out:
 	if (sret && opt_protocol)
 		applog(LOG_DEBUG, "< %s", sret);
@@ -794,11 +789,9 @@ bool stratum_connect(struct stratum_ctx *sctx, const char *url)
 		return false;
 	}
 	curl = sctx->curl;
-	if (!sctx->sockbuf) {
-		sctx->sockbuf = (char*)calloc(RBUFSIZE, 1);
-		sctx->sockbuf_size = RBUFSIZE;
-	}
-	sctx->sockbuf[0] = '\0';
+	if (!sctx->sockbuf)
+		sctx->sockbuf = (char*)malloc(STRATUM_RBUF_SIZE);
+	sctx->sockbuf_head = sctx->sockbuf_scan = sctx->sockbuf_tail = 0;
 	pthread_mutex_unlock(&sctx->sock_lock);
 
 	if (url != sctx->url) {
@@ -853,14 +846,285 @@ bool stratum_connect(struct stratum_ctx *sctx, const char *url)
 	return true;
 }
 
+/* Records a share about to be sent and returns the id to send it with */
+int stratum_submit_add(struct stratum_ctx *sctx, int thr_id, const char *job_id, uint32_t nonce)
+{
+	struct stratum_submit *sub;
+	int id;
+
+	pthread_mutex_lock(&sctx->submit_lock);
+	if (sctx->submit_id < STRATUM_SUBMIT_ID)
+		sctx->submit_id = STRATUM_SUBMIT_ID;
+	id = sctx->submit_id++;
+	sub = &sctx->submits[id % STRATUM_MAX_SUBMITS];
+	if (sub->id && opt_debug)
+		applog(LOG_DEBUG, "share %d was never answered", sub->id);
+	sub->id = id;
+	sub->thr_id = thr_id;
+	sub->nonce = nonce;
+	snprintf(sub->job_id, sizeof(sub->job_id), "%s", job_id);
+	gettimeofday(&sub->tv_sent, NULL);
+	pthread_mutex_unlock(&sctx->submit_lock);
+
+	return id;
+}
+
+/* Removes the share sent with id, false if there is none */
+bool stratum_submit_take(struct stratum_ctx *sctx, int id, struct stratum_submit *sub)
+{
+	struct stratum_submit *slot;
+	bool found = false;
+
+	if (id < STRATUM_SUBMIT_ID)
+		return false;
+
+	pthread_mutex_lock(&sctx->submit_lock);
+	slot = &sctx->submits[id % STRATUM_MAX_SUBMITS];
+	if (slot->id == id) {
+		*sub = *slot;
+		slot->id = 0;
+		found = true;
+	}
+	pthread_mutex_unlock(&sctx->submit_lock);
+
+	return found;
+}
+
+/* Forgets the shares and the probe not answered yet, returns the
+ * number of shares */
+int stratum_submit_clear(struct stratum_ctx *sctx)
+{
+	int i, n = 0;
+
+	pthread_mutex_lock(&sctx->submit_lock);
+	sctx->probe_id = 0;
+	for (i = 0; i < STRATUM_MAX_SUBMITS; i++) {
+		if (sctx->submits[i].id) {
+			sctx->submits[i].id = 0;
+			n++;
+		}
+	}
+	pthread_mutex_unlock(&sctx->submit_lock);
+
+	return n;
+}
+
+/* Sends a keepalive probe once nothing was received for idle ms and
+ * none is waiting; pools without mining.ping still answer it with an
+ * error, which tells as much, and any later line settles it too.
+ * False if it could not be queued */
+bool stratum_probe(struct stratum_ctx *sctx, uint64_t now, uint64_t idle)
+{
+	char s[80];
+	int id;
+
+	pthread_mutex_lock(&sctx->submit_lock);
+	if ((sctx->probe_id && sctx->last_line < sctx->probe_sent) ||
+	    now < sctx->last_line + idle) {
+		pthread_mutex_unlock(&sctx->submit_lock);
+		return true;
+	}
+	if (sctx->submit_id < STRATUM_SUBMIT_ID)
+		sctx->submit_id = STRATUM_SUBMIT_ID;
+	id = sctx->probe_id = sctx->submit_id++;
+	sctx->probe_sent = now;
+	pthread_mutex_unlock(&sctx->submit_lock);
+
+	sprintf(s, "{\"id\": %d, \"method\": \"mining.ping\", \"params\": []}", id);
+	return stratum_send_line(sctx, s);
+}
+
+/* Clears the probe if id is its answer, result or error alike */
+bool stratum_probe_answer(struct stratum_ctx *sctx, int id)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&sctx->submit_lock);
+	if (id && id == sctx->probe_id) {
+		if (opt_debug)
+			applog(LOG_DEBUG, "pool %d answered the keepalive in %u ms", sctx->pooln,
+				(uint32_t) (net_time_ms() - sctx->probe_sent));
+		sctx->probe_id = 0;
+		found = true;
+	}
+	pthread_mutex_unlock(&sctx->submit_lock);
+
+	return found;
+}
+
+/* Whether the probe went unanswered for timeout ms, with nothing else
+ * received from the pool since it was sent either */
+bool stratum_unanswered(struct stratum_ctx *sctx, uint64_t now, uint64_t timeout)
+{
+	bool ret;
+
+	pthread_mutex_lock(&sctx->submit_lock);
+	ret = sctx->probe_id && sctx->last_line < sctx->probe_sent &&
+		now >= sctx->probe_sent + timeout;
+	pthread_mutex_unlock(&sctx->submit_lock);
+
+	return ret;
+}
+
+#define pool_usable(sctx) ((sctx)->curl && (sctx)->job.job_id)
+
+/* Pool to mine on out of the n in the order of preference: the first
+ * one not leaving a probe unanswered for timeout ms, else current while
+ * it is connected, else any connected one; NULL if none is usable */
+struct stratum_ctx *stratum_pick(struct stratum_ctx *pools, int n,
+	struct stratum_ctx *current, uint64_t now, uint64_t timeout)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (pool_usable(&pools[i]) && !stratum_unanswered(&pools[i], now, timeout))
+			return &pools[i];
+	if (pool_usable(current))
+		return current;
+	for (i = 0; i < n; i++)
+		if (pool_usable(&pools[i]))
+			return &pools[i];
+
+	return NULL;
+}
+
+/* Host and port of the pool for the log */
+const char *pool_short_url(const struct stratum_ctx *sctx)
+{
+	const char *p = strstr(sctx->url, "://");
+
+	return p ? p + 3 : sctx->url;
+}
+
+/* Moves *current to the pool stratum_pick() chooses and logs why;
+ * returns that pool, or NULL with *current kept if none is usable.
+ * Called with the lock guarding *current held */
+struct stratum_ctx *stratum_switch(struct stratum_ctx *pools, int n,
+	struct stratum_ctx **current, uint64_t now, uint64_t timeout)
+{
+	struct stratum_ctx *sctx, *cur = *current;
+
+	sctx = stratum_pick(pools, n, cur, now, timeout);
+	if (!sctx || sctx == cur)
+		return sctx;
+
+	if (!cur->curl)
+		applog(LOG_WARNING, "Pool %d is down, switching to pool %d %s",
+			cur->pooln, sctx->pooln, pool_short_url(sctx));
+	else if (sctx->pooln > cur->pooln)
+		applog(LOG_WARNING, "Pool %d left the keepalive unanswered, switching to pool %d %s",
+			cur->pooln, sctx->pooln, pool_short_url(sctx));
+	else
+		applog(LOG_WARNING, "Switching back to pool %d %s",
+			sctx->pooln, pool_short_url(sctx));
+	*current = sctx;
+
+	return sctx;
+}
+
+/* Hands a connection made by the blocking handshake to loop: the
+ * socket turns non-blocking and stratum_send_line() queues to it */
+bool stratum_loop_start(struct stratum_ctx *sctx, struct net_loop *loop)
+{
+	pthread_mutex_lock(&sctx->sock_lock);
+	net_queue_clear(&sctx->sendq);
+	if (net_set_nonblocking(sctx->sock) && net_loop_watch(loop, sctx->sock, NET_READ))
+		sctx->loop = loop;
+	pthread_mutex_unlock(&sctx->sock_lock);
+	if (!sctx->loop)
+		return false;
+
+	sctx->last_line = net_time_ms();
+	return true;
+}
+
+/* Seconds without any data from the pool before dropping it */
+#define STRATUM_IDLE_TIMEOUT 120
+
+/* One pass of a pool thread over its connection: handles every complete
+ * line received, the answers through on_response, and calls on_line
+ * after each line and once more after the last. Then probes the pool
+ * once it is quiet, sends what was queued, waits for the pool, more to
+ * send, the time to probe, the probe timeout or the idle timeout, and
+ * reads what came. Returns false once the connection is dropped */
+bool stratum_loop_step(struct stratum_ctx *sctx, struct net_loop *loop, uint64_t probe_ms,
+	bool (*on_response)(struct stratum_ctx *sctx, char *s), void (*on_line)(void))
+{
+	curl_socket_t ready[NET_MAX_SOCKS];
+	unsigned int events[NET_MAX_SOCKS];
+	uint64_t now, until, deadline;
+	char *s;
+	int i, n;
+
+	while (sctx->curl && (s = stratum_next_line(sctx))) {
+		if (!stratum_handle_method(sctx, s))
+			on_response(sctx, s);
+		on_line();
+	}
+	on_line();
+	if (!sctx->curl)
+		return false;
+
+	if (!stratum_probe(sctx, net_time_ms(), probe_ms) ||
+	    !net_queue_flush(&sctx->sendq, sctx->sock))
+		goto interrupted;
+	net_loop_watch(loop, sctx->sock,
+		NET_READ | (net_queue_busy(&sctx->sendq) ? NET_WRITE : 0));
+
+	now = net_time_ms();
+	deadline = sctx->last_line + STRATUM_IDLE_TIMEOUT * 1000;
+	pthread_mutex_lock(&sctx->submit_lock);
+	if (sctx->probe_id && sctx->last_line < sctx->probe_sent)
+		until = sctx->probe_sent + probe_ms;
+	else
+		until = sctx->last_line + probe_ms;
+	pthread_mutex_unlock(&sctx->submit_lock);
+	if (now < until && until < deadline)
+		deadline = until;
+	n = net_loop_wait(loop, now < deadline ? (int) (deadline - now) : 0,
+		ready, events, NET_MAX_SOCKS);
+	if (n < 0)
+		goto interrupted;
+
+	for (i = 0; i < n; i++) {
+		if (ready[i] != sctx->sock || !(events[i] & NET_READ))
+			continue;
+		if (!stratum_recv_nonblock(sctx))
+			goto interrupted;
+		sctx->last_line = net_time_ms();
+	}
+
+	if (!n && net_time_ms() >= sctx->last_line + STRATUM_IDLE_TIMEOUT * 1000) {
+		applog(LOG_ERR, "Stratum connection timed out");
+		stratum_disconnect(sctx);
+		return false;
+	}
+	return true;
+
+interrupted:
+	stratum_disconnect(sctx);
+	applog(LOG_ERR, "Stratum connection interrupted");
+	return false;
+}
+
 void stratum_disconnect(struct stratum_ctx *sctx)
 {
+	int lost;
+
+	lost = stratum_submit_clear(sctx);
+	if (lost && !opt_quiet)
+		applog(LOG_WARNING, "%d share%s lost with the connection", lost, lost > 1 ? "s" : "");
+
 	pthread_mutex_lock(&sctx->sock_lock);
+	if (sctx->loop) {
+		net_loop_unwatch(sctx->loop, sctx->sock);
+		sctx->loop = NULL;
+	}
 	if (sctx->curl) {
 		sctx->disconnects++;
 		curl_easy_cleanup(sctx->curl);
 		sctx->curl = NULL;
-		sctx->sockbuf[0] = '\0';
+		sctx->sockbuf_head = sctx->sockbuf_scan = sctx->sockbuf_tail = 0;
 	}
 	pthread_mutex_unlock(&sctx->sock_lock);
 }
@@ -961,7 +1225,6 @@ start:
 		goto out;
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1041,11 +1304,9 @@ bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *p
 			goto out;
 		if (!stratum_handle_method(sctx, sret))
 			break;
-		free(sret);
 	}
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1095,7 +1356,6 @@ bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *p
 			}
 			json_decref(extra);
 		}
-		free(sret);
 	}
 	}
 
@@ -1202,10 +1462,13 @@ static bool stratum_notify(struct stratum_ctx *sctx, json_t *params)
 	sctx->job.xnonce2 = sctx->job.coinbase + coinb1_size + sctx->xnonce1_size;
 	hex2bin(sctx->job.coinbase, coinb1, coinb1_size);
 	memcpy(sctx->job.coinbase + coinb1_size, sctx->xnonce1, sctx->xnonce1_size);
+	sctx->job.midstate_size = (coinb1_size + sctx->xnonce1_size) & ~63;
+	sha256_midstate(sctx->job.midstate, sctx->job.coinbase, (int)sctx->job.midstate_size);
 
 	if (!sctx->job.job_id || strcmp(sctx->job.job_id, job_id))
 		memset(sctx->job.xnonce2, 0, sctx->xnonce2_size);
 	hex2bin(sctx->job.xnonce2 + sctx->xnonce2_size, coinb2, coinb2_size);
+	sctx->job.roots_left = 0;
 
 	free(sctx->job.job_id);
 	sctx->job.job_id = strdup(job_id);
@@ -1530,3 +1793,57 @@ char* format_hash(char* buf, uchar *hash)
 	}
 	return buf;
 }
+
+extern void sha256d(unsigned char *hash, const unsigned char *data, int len);
+extern void neoscrypt_blake2s_host(const uint32_t *input, const uint32_t *key,
+	uint32_t *output);
+
+/* The CPU checks of hash_selftest_cpu() and the GPU code prehash;
+ * returns false if anything does not match */
+bool hash_selftest(void)
+{
+	uint32_t key[8], input[16], hash[8];
+	bool rc;
+	uint i;
+
+	if (opt_debug)
+		print_hash_tests();
+
+	rc = hash_selftest_cpu((uint32_t) time(NULL));
+
+	/* BLAKE2s known answer of a one block message through the GPU code
+	 * prehash, input and key bytes 0 to 63 and 0 to 31 */
+	for (i = 0; i < 64; i++)
+		((uchar *) input)[i] = (uchar) i;
+	memcpy(key, input, 32);
+	neoscrypt_blake2s_host(input, key, hash);
+	rc &= selftest_compare("blake2s_host", (uchar *) hash,
+		"8975b0577fd35566d750b362b0897a26c399136df07bababbde6203ff2954ed4");
+
+	if (rc)
+		applog(LOG_INFO, "Self test passed");
+
+	return rc;
+}
+
+/* Hashes of an all zero 80-byte buffer, handy when porting */
+void print_hash_tests(void)
+{
+	uchar buf[80], hash[32];
+	char s[128];
+
+	memset(buf, 0, sizeof(buf));
+
+	printf("CPU hashes of an empty buffer:\n");
+
+	neoscrypt(buf, hash);
+	printf("%-10s %s\n", "neoscrypt", format_hash(s, hash));
+
+	neoscrypt_blake2s(buf, 64, buf, 32, hash, 32);
+	printf("%-10s %s\n", "blake2s", format_hash(s, hash));
+
+	sha256d(hash, buf, 80);
+	printf("%-10s %s\n", "sha256d", format_hash(s, hash));
+
+	printf("\n");
+}